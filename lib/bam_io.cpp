@@ -1,5 +1,6 @@
 // Taken from https://github.com/tfwillems/HipSTR/blob/master/src/bam_io.cpp
 
+#include <cstring>
 #include <sstream>
 
 #include "bam_io.h"
@@ -274,3 +275,76 @@ void BamAlignment::TrimAlignment(int32_t min_read_start, int32_t max_read_stop,
 void BamAlignment::TrimLowQualityEnds(char min_base_qual){
   return TrimAlignment(end_pos_+1, pos_-1, min_base_qual);
 }
+
+void BamAlignment::SetFields(const std::string& name, int32_t ref_id, int32_t pos, uint16_t flag, uint8_t map_quality,
+			     const std::vector<CigarOp>& cigar_ops, const std::string& bases, const std::string& qualities,
+			     int32_t mate_ref_id, int32_t mate_pos, int32_t template_length){
+  assert(bases.size() == qualities.size());
+  int32_t l_qname = name.size()+1;
+  int32_t l_qseq  = bases.size();
+  int32_t l_data  = l_qname + 4*cigar_ops.size() + (l_qseq+1)/2 + l_qseq;
+  if (b_->m_data < l_data){
+    b_->m_data = l_data;
+    b_->data   = (uint8_t*)realloc(b_->data, b_->m_data);
+  }
+  b_->l_data = l_data;
+
+  b_->core.tid     = ref_id;
+  b_->core.pos     = pos;
+  b_->core.qual    = map_quality;
+  b_->core.l_qname = l_qname;
+  b_->core.flag    = flag;
+  b_->core.n_cigar = cigar_ops.size();
+  b_->core.l_qseq  = l_qseq;
+  b_->core.mtid    = mate_ref_id;
+  b_->core.mpos    = mate_pos;
+  b_->core.isize   = template_length;
+
+  memcpy(b_->data, name.c_str(), l_qname);
+
+  int32_t ref_span = 0;
+  uint8_t* cigar   = (uint8_t*)bam_get_cigar(b_);
+  for (size_t i = 0; i < cigar_ops.size(); ++i){
+    const char* op = strchr(BAM_CIGAR_STR, cigar_ops[i].Type);
+    if (op == NULL)
+      PrintMessageDieOnError("Invalid CIGAR operation in SetFields", M_ERROR);
+    uint32_t value = ((uint32_t)cigar_ops[i].Length << BAM_CIGAR_SHIFT) | (uint32_t)(op - BAM_CIGAR_STR);
+    memcpy(cigar + 4*i, &value, 4);
+    if (strchr("MDN=X", cigar_ops[i].Type) != NULL)
+      ref_span += cigar_ops[i].Length;
+  }
+  b_->core.bin = hts_reg2bin(pos, pos + (ref_span > 0 ? ref_span : 1), 14, 5);
+
+  uint8_t* seq = bam_get_seq(b_);
+  memset(seq, 0, (l_qseq+1)/2);
+  for (int32_t i = 0; i < l_qseq; ++i)
+    seq[i>>1] |= seq_nt16_table[(unsigned char)bases[i]] << ((~i & 1) << 2);
+  uint8_t* qual = bam_get_qual(b_);
+  for (int32_t i = 0; i < l_qseq; ++i)
+    qual[i] = (uint8_t)(qualities[i] - 33);
+
+  built_     = false;
+  length_    = l_qseq;
+  pos_       = pos;
+  end_pos_   = pos + ref_span;
+}
+
+BamHeader* make_bam_header(const std::vector<std::string>& seq_names, const std::vector<uint32_t>& seq_lengths){
+  std::stringstream text;
+  text << "@HD\tVN:1.4\tSO:unsorted\n";
+  for (size_t i = 0; i < seq_names.size(); ++i)
+    text << "@SQ\tSN:" << seq_names[i] << "\tLN:" << seq_lengths[i] << "\n";
+  std::string header_text = text.str();
+
+  bam_hdr_t* hdr = sam_hdr_parse(header_text.size(), header_text.c_str());
+  if (hdr == NULL)
+    PrintMessageDieOnError("Failed to build BAM header", M_ERROR);
+  free(hdr->text);
+  hdr->l_text = header_text.size();
+  hdr->text   = (char*)malloc(hdr->l_text+1);
+  memcpy(hdr->text, header_text.c_str(), hdr->l_text+1);
+
+  BamHeader* bam_header = new BamHeader(hdr);
+  bam_hdr_destroy(hdr);
+  return bam_header;
+}
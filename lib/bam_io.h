@@ -317,6 +317,14 @@ class BamAlignment {
   void TrimAlignment(int32_t min_read_start, int32_t max_read_stop, char min_base_qual='~');
 
   void TrimLowQualityEnds(char min_base_qual);
+
+  /*
+   *  Fill in the alignment from scratch, e.g. to write out simulated reads
+   *  Bases and qualities (phred+33) are given in reference orientation
+   */
+  void SetFields(const std::string& name, int32_t ref_id, int32_t pos, uint16_t flag, uint8_t map_quality,
+		 const std::vector<CigarOp>& cigar_ops, const std::string& bases, const std::string& qualities,
+		 int32_t mate_ref_id, int32_t mate_pos, int32_t template_length);
 };
 
 
@@ -520,6 +528,9 @@ class BamCramReader {
 
 void compare_bam_headers(const BamHeader* hdr_a, const BamHeader* hdr_b, const std::string& file_a, const std::string& file_b);
 
+/* Build an unsorted BAM header listing the given reference sequences */
+BamHeader* make_bam_header(const std::vector<std::string>& seq_names, const std::vector<uint32_t>& seq_lengths);
+
 
 
 
@@ -591,11 +602,13 @@ class BamWriter {
   BamWriter& operator=(const BamWriter& other);
 
  public:
-  BamWriter(const std::string& path, const BamHeader* bam_header){
+  BamWriter(const std::string& path, const BamHeader* bam_header, int n_threads=1){
     std::string mode = "w";
     output_ = bgzf_open(path.c_str(), mode.c_str());
     if (output_ == NULL)
       PrintMessageDieOnError("Failed to open BAM output file", M_ERROR);
+    if (n_threads > 1 && bgzf_mt(output_, n_threads, 256) != 0)
+      PrintMessageDieOnError("Failed to set up BAM compression threads", M_ERROR);
     if (bam_hdr_write(output_, bam_header->header_) == -1)
       PrintMessageDieOnError("Failed to write the BAM header to the output file", M_ERROR);
   }
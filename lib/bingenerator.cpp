@@ -6,21 +6,16 @@
 #include <iostream>
 
 /*
-  Constructor for BinGenerator
-  
+  Constructor for BinTable
+
   Set up binning over a region, or over the entire genome
-  Initialize currentBin to the first bin
  */
-BinGenerator::BinGenerator(const Options& options) {
-  binsize = options.binsize;
-  string chrom;
-  int start;
-  int end;
- 
+BinTable::BinTable(const Options& options, const NRunIndex* nrun_index) {
   // default case
   if (options.region.empty())
   {
     // get the chroms and lengths from fasta file
+    map<string, int> chromLengths;
     RefGenome ref (options.reffa);
 
     if (!ref.GetChroms(&chroms))
@@ -30,20 +25,9 @@ BinGenerator::BinGenerator(const Options& options) {
       PrintMessageDieOnError("Could not gather chromosome lengths from "
                                  + options.reffa, M_ERROR);
 
-    // index for next chromosome
-    nextChrom = 1;
-      
-    // get last chromosome and the end of the first region
-    endChrom = chroms[chroms.size() - 1];
-    regEnd = chromLengths[chroms[0]];
-
-    // set up parameters for GenomeBin
-    chrom = chroms[0];
-    start = 1;
-    end = binsize;
-
-    if (binsize > regEnd)
-      end = regEnd;
+    // each chromosome is binned from position 1
+    for (size_t contig_id = 0; contig_id < chroms.size(); contig_id++)
+      AddBins(contig_id, 1, chromLengths[chroms[contig_id]], options.binsize, nrun_index);
   }
 
   // specified region
@@ -61,12 +45,9 @@ BinGenerator::BinGenerator(const Options& options) {
       PrintMessageDieOnError("Improper region input format should be chrom:start-end", M_ERROR);
 
     // get chromosome and remaining string
-    chrom = parts[0];
+    chroms.push_back(parts[0]);
     string start_end = parts[1];
-    
-    // set last chromosome to stop binning
-    endChrom = chrom;
- 
+
     // reset and store region locations
     parts.clear();
     ss.str(start_end);
@@ -79,87 +60,46 @@ BinGenerator::BinGenerator(const Options& options) {
     if (parts.size() != 2)
       PrintMessageDieOnError("Improper region input format should be chrom:start-end", M_ERROR);
 
-    // set first position to read from and set ending position
-    start = stoi(parts[0]);
-    regEnd = stoi(parts[1]);
-
-    // end of first bin size
-    end = start + binsize - 1; // NOTE: It is inclusive meaning the end position is included.
-
-    // check for size of region and ensure bin is inside
-    if (end > regEnd)
-      end = regEnd;
+    AddBins(0, stoi(parts[0]), stoi(parts[1]), options.binsize, nrun_index);
   }
-    
-  // first bin
-  firstBin = true;
-  currentBin = new GenomeBin(chrom, start, end);
 }
 
-
 /*
-  Inputs: none
-
-  Outputs: 
-  - bool: return true if there are still more bins left, else false
-
-  Set currentBin to be the next bin
+  Inputs:
+  - contig_id: index of the chromosome
+  - start: first position to bin
+  - regEnd: last position to bin
+  - binsize: size of each bin
+  - nrun_index: runs of N to leave out, or NULL
+
+  Add bins from start to regEnd. Bin ends are inclusive, and the last
+  bin is cut short at regEnd
  */
-bool BinGenerator::GotoNextBin() {
-  if (firstBin)
+void BinTable::AddBins(const int& contig_id, const int32_t& start, const int32_t& regEnd, const int& binsize,
+		       const NRunIndex* nrun_index) {
+  const vector<NRunIndex::Run>* nruns = (nrun_index != NULL) ? nrun_index->GetRuns(chroms[contig_id]) : NULL;
+  int32_t bin_start = start;
+  int32_t bin_end = start + binsize - 1;
+  bool contig_start = true;
+  while (true)
   {
-    firstBin = false;
-    return true;
-  }
-
-  // Go to the next bin
-  if (currentBin->end != regEnd || currentBin->chrom != endChrom)
-  {
-    // update the start and end
-    string chrom = currentBin->chrom;
-    int start = currentBin->start + binsize;
-    int end = currentBin->end + binsize;
-    
-    // update chromosome
-    if (currentBin->end == regEnd && currentBin->chrom != endChrom)
-    {
-      chrom = chroms[nextChrom];
-      start = 1;
-      end = binsize;
-      regEnd = chromLengths[chrom];
-      nextChrom++;
-    }
-
-    delete currentBin;
-
     // Check if the new bin is outside the end region
-    if (end <= regEnd)
-      currentBin = new GenomeBin(chrom, start, end);
-    else
-      currentBin = new GenomeBin(chrom, start, regEnd);
-
-    return true;
+    if (bin_end > regEnd)
+      bin_end = regEnd;
+    if (!NRunIndex::IsAllN(nruns, bin_start, bin_end))
+      bins.push_back(GenomeBin(contig_id, bin_start, bin_end, contig_start));
+    if (bin_end == regEnd)
+      break;
+    bin_start += binsize;
+    bin_end += binsize;
+    contig_start = false;
   }
-  else
-    return false;
-}
-
-/*
-  Inputs: none
-
-  Outputs:
-  - GenomeBin: the current genome bin that was set in GotoNextBin
- */
-const GenomeBin BinGenerator::GetCurrentBin() {
-  return *currentBin;
 }
 
-const string BinGenerator::GetCurrentBinStr() {
+const string BinTable::GetBinStr(const GenomeBin& bin) const {
   stringstream ss;
-  ss << currentBin->chrom << ":" << currentBin->start << "-" << currentBin->end;
+  ss << GetChrom(bin) << ":" << bin.start << "-" << bin.end;
   return ss.str();
 }
 
-BinGenerator::~BinGenerator() {
-  delete currentBin;
-}
+BinTable::~BinTable() {}
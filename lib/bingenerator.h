@@ -1,6 +1,7 @@
 #ifndef SRC_BINGENERATOR_H__
 #define SRC_BINGENERATOR_H__
 
+#include "n_run_index.h"
 #include "options.h"
 #include <vector>
 #include <map>
@@ -9,48 +10,54 @@ using namespace std;
 
 class GenomeBin {
  public:
-  std::string chrom;
+  int contig_id;     // index of the chromosome in BinTable::GetChroms
   int32_t start, end;
+  bool contig_start; // true if shearing starts fresh at this bin (first bin of a chrom/region)
 
-  GenomeBin(std::string chrom_, int32_t start_, int32_t end_) {
-    chrom = chrom_;
+  GenomeBin(int contig_id_, int32_t start_, int32_t end_, bool contig_start_=false) {
+    contig_id = contig_id_;
     start = start_;
     end = end_;
+    contig_start = contig_start_;
   }
 
   ~GenomeBin() {}
 };
 
-class BinGenerator {
+class BinTable {
   /*
     This class manages binning the genome
     If options.region is set, only get bins from that region
     Otherwise, bin the entire genome, getting the size from options.reffa
     Generate bins of size options.binsize
+    Bins that are all N in nrun_index are left out, if given
 
-    Before implementing, take a look at bedtools makewindows
-    Also, see ref_genome.h for reference genome class you will probably have to use here
+    The bins are laid out once per run and never change after, so all
+    threads can share one table. Bins only hold the index of their
+    chromosome, whose name is stored once
    */
  public:
-  BinGenerator(const Options& options);
-  virtual ~BinGenerator();
+  BinTable(const Options& options, const NRunIndex* nrun_index = NULL);
+  virtual ~BinTable();
 
-  /* Set the next bin */
-  bool GotoNextBin();
+  size_t size() const {return bins.size();}
+  const GenomeBin& operator[](const size_t& bin_index) const {return bins[bin_index];}
 
-  /* Return the current bin */
-  const GenomeBin GetCurrentBin();
+  /* Name of the chromosome of a bin */
+  const string& GetChrom(const GenomeBin& bin) const {return chroms[bin.contig_id];}
 
-  /* Return string version of current bin */
-  const string GetCurrentBinStr();
+  /* All chromosomes with bins, in order */
+  const vector<string>& GetChroms() const {return chroms;}
+
+  /* Return string version of a bin */
+  const string GetBinStr(const GenomeBin& bin) const;
 
  private:
-  GenomeBin* currentBin;
   vector<string> chroms;
-  map<string, int> chromLengths;
-  string endChrom;
-  int regEnd, binsize, nextChrom;
-  bool firstBin;
+  vector<GenomeBin> bins;
+
+  void AddBins(const int& contig_id, const int32_t& start, const int32_t& regEnd, const int& binsize,
+	       const NRunIndex* nrun_index);
 };
 
 #endif  // SRC_BINGENERATOR_H__
@@ -0,0 +1,141 @@
+#include "checkpoint_journal.h"
+#include "common.h"
+
+#include <cstdio>
+#include <sstream>
+#include <unistd.h>
+
+CheckpointJournal::CheckpointJournal(const std::string& _filename) {
+  filename = _filename;
+}
+
+void CheckpointJournal::Start(const unsigned& seed, const std::string& settings) {
+  done_copies.clear();
+  journal.open(filename.c_str(), std::ofstream::out | std::ofstream::trunc);
+  journal << "#seed\t" << seed << "\n"
+	  << "#settings\t" << settings << "\n" << std::flush;
+  if (!journal) {
+    PrintMessageDieOnError("Failed to write " + filename, M_ERROR);
+  }
+}
+
+bool CheckpointJournal::Resume(const std::string& settings,
+			       const std::vector<std::vector<std::string> >& writer_files,
+			       unsigned* seed) {
+  std::ifstream input(filename.c_str());
+  if (!input.is_open()) {
+    return false;
+  }
+  std::string line, key, value;
+  bool got_seed = false;
+  std::vector<std::vector<std::int64_t> > file_sizes(writer_files.size());
+  std::vector<bool> writer_ok(writer_files.size(), true);
+  std::vector<std::string> kept_lines;
+  for (size_t writer_index=0; writer_index<writer_files.size(); writer_index++) {
+    file_sizes[writer_index].assign(writer_files[writer_index].size(), 0);
+  }
+  while (std::getline(input, line)) {
+    if (line.empty()) continue;
+    if (line[0] == '#') {
+      size_t tab = line.find('\t');
+      key = line.substr(0, tab);
+      value = (tab == std::string::npos) ? "" : line.substr(tab+1);
+      if (key == "#seed") {
+	*seed = (unsigned) std::stoul(value);
+	got_seed = true;
+      } else if (key == "#settings" && value != settings) {
+	PrintMessageDieOnError("Options differ from the run recorded in " + filename +
+			       ". Resume with the same options", M_ERROR);
+      } else if (key == "#merge") {
+	PrintMessageDieOnError("The previous run was stopped while merging its output files, "
+			       "it can't be resumed. Rerun without --resume", M_ERROR);
+      }
+      continue;
+    }
+    // copy_index writer_index file sizes...
+    std::stringstream ss(line);
+    int copy_index, writer_index;
+    if (!(ss >> copy_index >> writer_index) || writer_index < 0 || writer_index >= (int) writer_files.size()) {
+      break; // cut off while writing the line
+    }
+    std::vector<std::int64_t> sizes(writer_files[writer_index].size());
+    bool complete = true;
+    for (size_t i=0; i<sizes.size(); i++) {
+      if (!(ss >> sizes[i])) complete = false;
+    }
+    if (!complete) break;
+    // The journal may run ahead of the files if the machine went down;
+    // a writer's copies after the first one that isn't on disk are redone
+    for (size_t i=0; i<sizes.size(); i++) {
+      if (GetFileSize(writer_files[writer_index][i]) < sizes[i]) writer_ok[writer_index] = false;
+    }
+    if (!writer_ok[writer_index]) continue;
+    file_sizes[writer_index] = sizes;
+    done_copies.insert(copy_index);
+    kept_lines.push_back(line);
+  }
+  input.close();
+  if (!got_seed) {
+    return false;
+  }
+
+  // Drop whatever was written after each writer's last recorded copy
+  for (size_t writer_index=0; writer_index<writer_files.size(); writer_index++) {
+    for (size_t i=0; i<writer_files[writer_index].size(); i++) {
+      const std::string& file = writer_files[writer_index][i];
+      if (GetFileSize(file) == -1) continue;
+      if (truncate(file.c_str(), file_sizes[writer_index][i]) != 0) {
+	PrintMessageDieOnError("Failed to truncate " + file, M_ERROR);
+      }
+    }
+  }
+
+  // Replace the journal by one without anything that was dropped
+  std::string tmp_filename = filename + ".tmp";
+  std::ofstream rewritten(tmp_filename.c_str(), std::ofstream::out | std::ofstream::trunc);
+  rewritten << "#seed\t" << *seed << "\n"
+	    << "#settings\t" << settings << "\n";
+  for (size_t i=0; i<kept_lines.size(); i++) {
+    rewritten << kept_lines[i] << "\n";
+  }
+  rewritten.close();
+  if (!rewritten || std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+    PrintMessageDieOnError("Failed to write " + filename, M_ERROR);
+  }
+  journal.open(filename.c_str(), std::ofstream::out | std::ofstream::app);
+  return true;
+}
+
+void CheckpointJournal::Record(const int& copy_index, const int& writer_index,
+			       const std::vector<std::int64_t>& file_sizes) {
+  std::stringstream ss;
+  ss << copy_index << "\t" << writer_index;
+  for (size_t i=0; i<file_sizes.size(); i++) {
+    ss << "\t" << file_sizes[i];
+  }
+  ss << "\n";
+  std::lock_guard<std::mutex> lock(journal_mutex);
+  journal << ss.str() << std::flush;
+  if (!journal) {
+    PrintMessageDieOnError("Failed to write " + filename, M_ERROR);
+  }
+}
+
+void CheckpointJournal::StartMerge() {
+  std::lock_guard<std::mutex> lock(journal_mutex);
+  journal << "#merge\n" << std::flush;
+}
+
+void CheckpointJournal::Remove() {
+  std::lock_guard<std::mutex> lock(journal_mutex);
+  journal.close();
+  std::remove(filename.c_str());
+}
+
+bool CheckpointJournal::IsDone(const int& copy_index) const {
+  return done_copies.find(copy_index) != done_copies.end();
+}
+
+CheckpointJournal::~CheckpointJournal() {
+  if (journal.is_open()) journal.close();
+}
@@ -0,0 +1,54 @@
+#ifndef SRC_CHECKPOINT_JOURNAL_H__
+#define SRC_CHECKPOINT_JOURNAL_H__
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+class CheckpointJournal {
+  /*
+    This class keeps a journal of finished genome copies so an interrupted
+    simreads run can pick up where it stopped. The journal starts with the
+    random seed and the settings of the run, then writer threads add one
+    line per copy once its reads are handed to the OS:
+      copy_index  writer_index  size of each of the writer's files
+    On resume, each writer's files are cut back to the sizes after its last
+    recorded copy, and recorded copies are skipped. Every copy has its own
+    random seed, so the remaining copies come out as in an uninterrupted run.
+   */
+ public:
+  CheckpointJournal(const std::string& _filename);
+  virtual ~CheckpointJournal();
+
+  /* Start a new journal */
+  void Start(const unsigned& seed, const std::string& settings);
+
+  /* Load an existing journal of a run with the same settings, then keep
+     adding to it. writer_files lists the files of each writer thread.
+     Returns false if there is no journal to resume from */
+  bool Resume(const std::string& settings, const std::vector<std::vector<std::string> >& writer_files,
+	      unsigned* seed);
+
+  /* Record a finished copy along with the sizes of its writer's files */
+  void Record(const int& copy_index, const int& writer_index, const std::vector<std::int64_t>& file_sizes);
+
+  /* Mark the start of merging the per-writer files, which can't be resumed */
+  void StartMerge();
+
+  /* Remove the journal once the run completed */
+  void Remove();
+
+  bool IsDone(const int& copy_index) const;
+
+ private:
+  std::string filename;
+  std::ofstream journal;
+  std::mutex journal_mutex;
+  std::set<int> done_copies;
+};
+
+#endif  // SRC_CHECKPOINT_JOURNAL_H__
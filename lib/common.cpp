@@ -1,5 +1,6 @@
 #include <err.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 
 #include <iostream>
 #include <sstream>
@@ -36,3 +37,11 @@ void PrintMessageDieOnError(const string& msg, MSGTYPE msgtype) {
     exit(1);
   }
 }
+
+int64_t GetFileSize(const string& filename) {
+  struct stat st;
+  if (stat(filename.c_str(), &st) != 0) {
+    return -1;
+  }
+  return st.st_size;
+}
@@ -1,6 +1,7 @@
 #ifndef SRC_COMMON_H__
 #define SRC_COMMON_H__
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -17,4 +18,7 @@ enum MSGTYPE {
 void PrintMessageDieOnError(const std::string& msg,
                             MSGTYPE msgtype);
 
+// Size of a file in bytes, -1 if it doesn't exist
+std::int64_t GetFileSize(const std::string& filename);
+
 #endif  // SRC_COMMON_H__
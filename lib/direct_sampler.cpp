@@ -0,0 +1,101 @@
+#include "direct_sampler.h"
+#include "common.h"
+
+#include <algorithm>
+#include <cmath>
+
+DirectSampler::DirectSampler(const Options& options, const BinTable& _bins, PeakIntervals* _pintervals,
+			     const FragmentLengths& _frag_lengths, const NRunIndex* _nrun_index)
+  : bins(_bins), pintervals(_pintervals), nrun_index(_nrun_index), frag_lengths(_frag_lengths) {
+  readlen = options.readlen;
+  float ratio_beta = options.ratio_f*(1-options.ratio_s)/(options.ratio_s*(1-options.ratio_f));
+  ratio_beta = std::min(ratio_beta, (float) 1);
+
+  // Fragments start uniformly over the bins
+  double total_length = 0;
+  for (size_t bin_index=0; bin_index<bins.size(); bin_index++) {
+    const GenomeBin& gbin = bins[bin_index];
+    const std::string& chrom = bins.GetChrom(gbin);
+    total_length += gbin.end-gbin.start;
+    bin_cumlength.push_back(total_length);
+    if (chrom_span.find(chrom) == chrom_span.end()) {
+      chrom_span[chrom] = std::make_pair(gbin.start, gbin.end);
+    } else {
+      chrom_span[chrom].first = std::min(chrom_span[chrom].first, gbin.start);
+      chrom_span[chrom].second = std::max(chrom_span[chrom].second, gbin.end);
+    }
+  }
+
+  // Integrating overlap*score/length over fragment starts gives score*length
+  double total_peak_weight = 0;
+  const std::map<std::string, std::vector<Fragment> >& peak_map = pintervals->GetPeaks();
+  for (std::map<std::string, std::vector<Fragment> >::const_iterator it = peak_map.begin();
+       it != peak_map.end(); it++) {
+    for (size_t peak_index=0; peak_index<it->second.size(); peak_index++) {
+      const Fragment& peak = it->second[peak_index];
+      if (peak.score <= 0 || peak.length == 0) continue;
+      total_peak_weight += peak.score*peak.length;
+      peaks.push_back(&peak);
+      peak_cumweight.push_back(total_peak_weight);
+    }
+  }
+
+  background_weight = ratio_beta*total_length;
+  total_weight = background_weight + (1-ratio_beta)*total_peak_weight;
+  if (total_weight <= 0) {
+    PrintMessageDieOnError("Nothing to sample fragments from with --engine direct", M_ERROR);
+  }
+}
+
+void DirectSampler::Perform(std::vector<Fragment>* output_fragments, const std::int64_t& numfrags, SimRng& rng) const {
+  std::uniform_real_distribution<double> unif(0, 1);
+  std::string chrom;
+  std::int32_t fstart;
+  int fsize;
+  std::int64_t num_sampled = 0;
+  while (num_sampled < numfrags) {
+    fsize = frag_lengths.Sample(rng);
+    if (fsize <= 0) continue;
+
+    bool from_peak = (unif(rng)*total_weight >= background_weight);
+    if (!from_peak) {
+      // Uniform start over all bins
+      double pos = unif(rng)*bin_cumlength.back();
+      size_t bin_index = std::min((size_t) (std::upper_bound(bin_cumlength.begin(), bin_cumlength.end(), pos)
+					    - bin_cumlength.begin()), bins.size()-1);
+      double bin_offset = pos - (bin_index > 0 ? bin_cumlength[bin_index-1] : 0);
+      chrom = bins.GetChrom(bins[bin_index]);
+      fstart = bins[bin_index].start + (std::int32_t) bin_offset;
+    } else {
+      // Pick a peak base, then place the fragment uniformly over it
+      double weight = unif(rng)*peak_cumweight.back();
+      size_t peak_index = std::min((size_t) (std::upper_bound(peak_cumweight.begin(), peak_cumweight.end(), weight)
+					     - peak_cumweight.begin()), peaks.size()-1);
+      const Fragment* peak = peaks[peak_index];
+      std::int32_t covered = peak->start + (std::int32_t) (unif(rng)*peak->length);
+      chrom = peak->chrom;
+      fstart = covered - (std::int32_t) (unif(rng)*fsize);
+      std::map<std::string, std::pair<std::int32_t, std::int32_t> >::const_iterator span = chrom_span.find(chrom);
+      if (span == chrom_span.end() || fstart < span->second.first || fstart >= span->second.second) {
+	continue;
+      }
+    }
+
+    if (nrun_index != NULL && NRunIndex::HasAllNRead(nrun_index->GetRuns(chrom), fstart, fsize, readlen)) {
+      continue;
+    }
+
+    Fragment frag(chrom, fstart, fsize);
+    if (from_peak) {
+      float score_sum;
+      float peak_score = pintervals->GetOverlap(frag, &score_sum);
+      if (unif(rng)*score_sum > peak_score) {
+	continue;
+      }
+    }
+    output_fragments->push_back(frag);
+    num_sampled += 1;
+  }
+}
+
+DirectSampler::~DirectSampler() {}
@@ -0,0 +1,55 @@
+#ifndef SRC_DIRECT_SAMPLER_H__
+#define SRC_DIRECT_SAMPLER_H__
+
+#include "bingenerator.h"
+#include "fragment.h"
+#include "fragment_lengths.h"
+#include "n_run_index.h"
+#include "options.h"
+#include "peak_intervals.h"
+#include "sim_rng.h"
+
+#include <vector>
+#include <random>
+
+class DirectSampler {
+  /*
+    This class draws library fragments of a genome copy directly, without
+    shearing the whole genome first (--engine direct).
+
+    In the shearing engine fragments start at rate 1/(mean length) along
+    the genome, have lengths drawn from FragmentLengths, and are kept with
+    probability q = s + (1-s)*beta, where s is the bound probability from the peaks.
+    Sequencing then picks fragments uniformly among those kept. When a copy
+    gets far fewer reads than it has fragments, this is the same as drawing
+    each read's fragment independently with density proportional to q,
+    which is done here by rejection sampling from a mixture of
+    - uniform fragment starts over all bins (weight beta)
+    - fragments covering a base drawn from peaks by score*length (weight 1-beta)
+    The peak part uses the sum of overlap*score as an upper bound of s and
+    accepts with probability s/sum.
+   */
+ public:
+  DirectSampler(const Options& options, const BinTable& _bins, PeakIntervals* _pintervals,
+		const FragmentLengths& _frag_lengths, const NRunIndex* _nrun_index = NULL);
+  virtual ~DirectSampler();
+
+  /* Draw numfrags fragments, in random order */
+  void Perform(std::vector<Fragment>* output_fragments, const std::int64_t& numfrags, SimRng& rng) const;
+
+ private:
+  const BinTable& bins;
+  PeakIntervals* pintervals;
+  const NRunIndex* nrun_index; // fragments with all N reads are redrawn
+  int readlen;
+  const FragmentLengths& frag_lengths;
+
+  std::vector<double> bin_cumlength;  // cumulative bin lengths
+  std::vector<const Fragment*> peaks; // all peaks
+  std::vector<double> peak_cumweight; // cumulative score*length of peaks
+  std::map<std::string, std::pair<std::int32_t, std::int32_t> > chrom_span; // range covered by bins
+  double background_weight;
+  double total_weight;
+};
+
+#endif  // SRC_DIRECT_SAMPLER_H__
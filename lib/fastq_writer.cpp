@@ -0,0 +1,69 @@
+#include "fastq_writer.h"
+#include "common.h"
+#include "htslib/hfile.h"
+
+FastqWriter::FastqWriter(const std::string& _filename, const bool& compress, const int& compress_threads,
+			 const bool& append) {
+  filename = _filename;
+  bgzf_output = NULL;
+  if (compress) {
+    bgzf_output = bgzf_open(filename.c_str(), append ? "a" : "w");
+    if (bgzf_output == NULL) {
+      PrintMessageDieOnError("Failed to open " + filename, M_ERROR);
+    }
+    if (compress_threads > 1 && bgzf_mt(bgzf_output, compress_threads, 256) != 0) {
+      PrintMessageDieOnError("Failed to set up compression threads for " + filename, M_ERROR);
+    }
+  } else {
+    text_output.open(filename.c_str(), std::ofstream::out | std::ofstream::binary |
+		     (append ? std::ofstream::app : std::ofstream::trunc));
+    if (!text_output.is_open()) {
+      PrintMessageDieOnError("Failed to open " + filename, M_ERROR);
+    }
+  }
+}
+
+void FastqWriter::Write(const std::string& records) {
+  if (bgzf_output != NULL) {
+    if (bgzf_write(bgzf_output, records.data(), records.size()) < 0) {
+      PrintMessageDieOnError("Failed to write to " + filename, M_ERROR);
+    }
+  } else {
+    text_output.write(records.data(), records.size());
+    if (!text_output) {
+      PrintMessageDieOnError("Failed to write to " + filename, M_ERROR);
+    }
+  }
+}
+
+std::int64_t FastqWriter::Flush() {
+  if (bgzf_output != NULL) {
+    if (bgzf_flush(bgzf_output) != 0 || hflush(bgzf_output->fp) != 0) {
+      PrintMessageDieOnError("Failed to write to " + filename, M_ERROR);
+    }
+  } else {
+    text_output.flush();
+    if (!text_output) {
+      PrintMessageDieOnError("Failed to write to " + filename, M_ERROR);
+    }
+  }
+  return GetFileSize(filename);
+}
+
+void FastqWriter::Close() {
+  if (bgzf_output != NULL) {
+    if (bgzf_close(bgzf_output) != 0) {
+      PrintMessageDieOnError("Failed to close " + filename, M_ERROR);
+    }
+    bgzf_output = NULL;
+  } else if (text_output.is_open()) {
+    text_output.close();
+    if (!text_output) {
+      PrintMessageDieOnError("Failed to close " + filename, M_ERROR);
+    }
+  }
+}
+
+FastqWriter::~FastqWriter() {
+  Close();
+}
@@ -0,0 +1,39 @@
+#ifndef SRC_FASTQ_WRITER_H__
+#define SRC_FASTQ_WRITER_H__
+
+#include "htslib/bgzf.h"
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+class FastqWriter {
+  /*
+    This class writes FASTQ records of one worker thread to a file,
+    either as plain text or BGZF compressed (.fastq.gz).
+    BGZF blocks are compressed by compress_threads threads in the background.
+    BGZF files can be concatenated, so per-thread files are merged as usual.
+    With append, records are added to an existing file (to resume a run).
+   */
+ public:
+  FastqWriter(const std::string& _filename, const bool& compress, const int& compress_threads,
+	      const bool& append = false);
+  virtual ~FastqWriter();
+
+  /* Append formatted records */
+  void Write(const std::string& records);
+
+  /* Hand everything written so far to the OS (ending the BGZF block),
+     return the file size */
+  std::int64_t Flush();
+
+  /* Flush and close the file */
+  void Close();
+
+ private:
+  std::string filename;
+  BGZF* bgzf_output;
+  std::ofstream text_output;
+};
+
+#endif  // SRC_FASTQ_WRITER_H__
@@ -0,0 +1,185 @@
+#include "fragment_lengths.h"
+#include "common.h"
+
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+namespace {
+// Stop the gamma table once this little probability is left beyond it
+const double GammaTailMass = 1e-9;
+// and never make it longer than this
+const int32_t MaxTableLength = 1 << 22;
+
+/*
+  Regularized lower incomplete gamma function P(a, x), the CDF of
+  Gamma(a, 1) at x. Series for x < a+1, continued fraction otherwise
+  (Numerical Recipes 6.2)
+ */
+double RegularizedGammaP(const double& a, const double& x) {
+  const int max_iterations = 10000;
+  const double eps = 1e-15;
+  const double tiny = 1e-300;
+  if (x <= 0) return 0;
+  double log_prefactor = -x + a*log(x) - lgamma(a);
+  if (x < a+1) {
+    double ap = a;
+    double term = 1/a;
+    double sum = term;
+    for (int i=0; i<max_iterations; i++) {
+      ap += 1;
+      term *= x/ap;
+      sum += term;
+      if (fabs(term) < fabs(sum)*eps) break;
+    }
+    return sum*exp(log_prefactor);
+  }
+  double b = x+1-a;
+  double c = 1/tiny;
+  double d = 1/b;
+  double h = d;
+  for (int i=1; i<=max_iterations; i++) {
+    double an = -i*(i-a);
+    b += 2;
+    d = an*d + b;
+    if (fabs(d) < tiny) d = tiny;
+    c = b + an/c;
+    if (fabs(c) < tiny) c = tiny;
+    d = 1/d;
+    double delta = d*c;
+    h *= delta;
+    if (fabs(delta-1) < eps) break;
+  }
+  return 1 - exp(log_prefactor)*h;
+}
+}
+
+FragmentLengths::FragmentLengths(const Options& options) {
+  gamma_k = options.gamma_k;
+  gamma_theta = options.gamma_theta;
+  gamma = options.frag_lens_file.empty();
+  std::vector<double> weights; // by length, from 0
+  if (gamma) {
+    LoadGamma(&weights);
+  } else {
+    LoadHistogram(options.frag_lens_file, &weights);
+  }
+
+  double total = 0, sum = 0, sum_squares = 0;
+  for (size_t length=0; length<weights.size(); length++) {
+    total += weights[length];
+    sum += weights[length]*length;
+    sum_squares += weights[length]*length*length;
+  }
+  if (!(total > 0)) {
+    PrintMessageDieOnError("No fragment lengths to sample from", M_ERROR);
+  }
+  mean = sum/total;
+  variance = sum_squares/total - mean*mean;
+
+  int32_t min_length = 0;
+  while (weights[min_length] == 0) min_length++;
+  std::vector<double> length_weights(weights.begin()+min_length, weights.end());
+  std::vector<double> covering_weights(length_weights.size());
+  for (size_t i=0; i<length_weights.size(); i++) {
+    covering_weights[i] = length_weights[i]*(min_length+i);
+  }
+  lengths.Build(min_length, length_weights);
+  if (mean > 0) {
+    covering_lengths.Build(min_length, covering_weights);
+  } else {
+    covering_lengths.Build(min_length, length_weights); // all of length 0
+  }
+}
+
+/*
+  Gamma(k, theta) rounded to the nearest base: length n has the mass
+  of [n-0.5, n+0.5)
+ */
+void FragmentLengths::LoadGamma(std::vector<double>* weights) {
+  if (!(gamma_k > 0 && gamma_theta > 0)) {
+    PrintMessageDieOnError("Fragment length parameters (k, theta) must be positive", M_ERROR);
+  }
+  weights->clear();
+  double gamma_mean = (double) gamma_k*gamma_theta;
+  double cdf_below = 0;
+  for (int32_t length=0; length<MaxTableLength; length++) {
+    double cdf = RegularizedGammaP(gamma_k, (length+0.5)/gamma_theta);
+    weights->push_back(std::max(0.0, cdf-cdf_below));
+    cdf_below = cdf;
+    if (length > gamma_mean && 1-cdf < GammaTailMass) break;
+  }
+}
+
+/*
+  Counts of the lengths in a file with one length per line
+ */
+void FragmentLengths::LoadHistogram(const std::string& filename, std::vector<double>* weights) {
+  ifstream input(filename.c_str());
+  if (!input.good()) {
+    PrintMessageDieOnError("Fragment length file " + filename + " does not exist", M_ERROR);
+  }
+  weights->clear();
+  std::string line;
+  int line_number = 0;
+  while (getline(input, line)) {
+    line_number++;
+    if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+    std::istringstream fields(line);
+    int64_t length;
+    std::string rest;
+    if (!(fields >> length) || (fields >> rest) || length < 0 || length >= MaxTableLength) {
+      stringstream ss;
+      ss << "Invalid fragment length on line " << line_number << " of " << filename;
+      PrintMessageDieOnError(ss.str(), M_ERROR);
+    }
+    if (length == 0) continue; // mates with no insert size
+    if ((int64_t) weights->size() <= length) {
+      weights->resize(length+1, 0);
+    }
+    (*weights)[length] += 1;
+  }
+}
+
+/*
+  Vose's construction: split the weights into columns of equal height,
+  each holding at most two values
+ */
+void FragmentLengths::AliasTable::Build(const int32_t& _min_value, const std::vector<double>& weights) {
+  min_value = _min_value;
+  size_t size = weights.size();
+  prob.assign(size, 1);
+  alias.resize(size);
+  double total = 0;
+  for (size_t i=0; i<size; i++) {
+    total += weights[i];
+  }
+  std::vector<double> scaled(size);
+  std::vector<uint32_t> small, large;
+  for (size_t i=0; i<size; i++) {
+    alias[i] = (uint32_t) i;
+    scaled[i] = weights[i]*size/total;
+    if (scaled[i] < 1) {
+      small.push_back((uint32_t) i);
+    } else {
+      large.push_back((uint32_t) i);
+    }
+  }
+  while (!small.empty() && !large.empty()) {
+    uint32_t less = small.back();
+    small.pop_back();
+    uint32_t more = large.back();
+    prob[less] = (float) scaled[less];
+    alias[less] = more;
+    scaled[more] -= 1-scaled[less];
+    if (scaled[more] < 1) {
+      large.pop_back();
+      small.push_back(more);
+    }
+  }
+  // What's left is 1 up to rounding
+}
+
+FragmentLengths::~FragmentLengths() {}
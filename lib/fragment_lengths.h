@@ -0,0 +1,62 @@
+#ifndef SRC_FRAGMENT_LENGTHS_H__
+#define SRC_FRAGMENT_LENGTHS_H__
+
+#include "options.h"
+#include "sim_rng.h"
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+class FragmentLengths {
+  /*
+    The distribution of fragment lengths, built once per run and shared
+    (read-only) by all threads. Lengths are whole numbers of bases, so
+    the distribution is a table over lengths, sampled in O(1) with
+    Walker's alias method.
+
+    The table is either Gamma(k, theta) rounded to the nearest base
+    (--gamma-frag), or the histogram of the lengths in a file with one
+    length per line, such as learn --output-frag-lens writes (--frag-lens).
+   */
+ public:
+  FragmentLengths(const Options& options);
+  virtual ~FragmentLengths();
+
+  /* The length of a fragment */
+  int32_t Sample(SimRng& rng) const {return lengths.Sample(rng);}
+
+  /* The length of the fragment covering a given base. Longer fragments
+     cover more bases, so this is the length distribution weighted by length */
+  int32_t SampleCovering(SimRng& rng) const {return covering_lengths.Sample(rng);}
+
+  double Mean() const {return mean;}
+  double Variance() const {return variance;}
+
+ private:
+  class AliasTable {
+  public:
+    void Build(const int32_t& _min_value, const std::vector<double>& weights);
+    int32_t Sample(SimRng& rng) const {
+      uint32_t index = (uint32_t) (((uint64_t) rng() * prob.size()) >> 32);
+      return min_value + (int32_t) ((rng.Uniform() < prob[index]) ? index : alias[index]);
+    }
+  private:
+    int32_t min_value;
+    std::vector<float> prob;
+    std::vector<uint32_t> alias;
+  };
+
+  AliasTable lengths;
+  AliasTable covering_lengths;
+  bool gamma;
+  float gamma_k, gamma_theta;
+  double mean;
+  double variance;
+
+  void LoadGamma(std::vector<double>* weights);
+  void LoadHistogram(const std::string& filename, std::vector<double>* weights);
+};
+
+#endif  // SRC_FRAGMENT_LENGTHS_H__
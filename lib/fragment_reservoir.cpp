@@ -0,0 +1,67 @@
+#include "fragment_reservoir.h"
+
+#include <algorithm>
+
+FragmentReservoir::FragmentReservoir(const std::size_t& _capacity) {
+  capacity = _capacity;
+  num_seen = 0;
+}
+
+/*
+  Order entries by key. Ties (practically never seen with 53-bit keys)
+  are broken by position so that merges stay order independent.
+ */
+bool FragmentReservoir::EntryLess(const Entry& a, const Entry& b) {
+  if (a.key != b.key) return a.key < b.key;
+  if (a.frag.chrom != b.frag.chrom) return a.frag.chrom < b.frag.chrom;
+  if (a.frag.start != b.frag.start) return a.frag.start < b.frag.start;
+  return a.frag.length < b.frag.length;
+}
+
+void FragmentReservoir::AddEntry(const Entry& entry) {
+  if (entries.size() < capacity) {
+    entries.push_back(entry);
+    std::push_heap(entries.begin(), entries.end(), EntryLess);
+  } else if (capacity > 0 && EntryLess(entry, entries.front())) {
+    std::pop_heap(entries.begin(), entries.end(), EntryLess);
+    entries.back() = entry;
+    std::push_heap(entries.begin(), entries.end(), EntryLess);
+  }
+}
+
+void FragmentReservoir::Add(const Fragment& frag, SimRng& rng) {
+  std::uniform_real_distribution<double> keydist(0, 1);
+  double key = keydist(rng);
+  num_seen += 1;
+  // Most fragments are rejected; skip building an entry for them
+  if (entries.size() == capacity && (capacity == 0 || key > entries.front().key)) {
+    return;
+  }
+  AddEntry(Entry(key, frag));
+}
+
+void FragmentReservoir::Merge(const FragmentReservoir& other) {
+  for (size_t entry_index=0; entry_index<other.entries.size(); entry_index++) {
+    AddEntry(other.entries[entry_index]);
+  }
+  num_seen += other.num_seen;
+}
+
+/*
+  Keys are i.i.d. uniform, so sorting by key gives a uniformly random
+  order of the sampled fragments.
+ */
+void FragmentReservoir::GetFragments(std::vector<Fragment>* output_fragments) const {
+  std::vector<Entry> sorted_entries(entries);
+  std::sort(sorted_entries.begin(), sorted_entries.end(), EntryLess);
+  for (size_t entry_index=0; entry_index<sorted_entries.size(); entry_index++) {
+    output_fragments->push_back(sorted_entries[entry_index].frag);
+  }
+}
+
+void FragmentReservoir::Clear() {
+  std::vector<Entry>().swap(entries);
+  num_seen = 0;
+}
+
+FragmentReservoir::~FragmentReservoir() {}
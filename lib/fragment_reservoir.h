@@ -0,0 +1,54 @@
+#ifndef SRC_FRAGMENT_RESERVOIR_H__
+#define SRC_FRAGMENT_RESERVOIR_H__
+
+#include "fragment.h"
+#include "sim_rng.h"
+
+#include <vector>
+#include <random>
+
+class FragmentReservoir {
+  /*
+    This class keeps a uniform random sample (without replacement) of
+    at most capacity fragments out of a stream of fragments.
+
+    Every fragment is tagged with a random key and the capacity fragments
+    with the smallest keys are kept (bottom-k sampling). Unlike classic
+    reservoir sampling, the sample of a union is the sample of the samples,
+    so reservoirs filled by different threads can be merged in any order
+    and still give the same result.
+   */
+ public:
+  FragmentReservoir(const std::size_t& _capacity=0);
+  virtual ~FragmentReservoir();
+
+  /* Offer a fragment to the sample, drawing its key from rng */
+  void Add(const Fragment& frag, SimRng& rng);
+
+  /* Add everything sampled by another reservoir */
+  void Merge(const FragmentReservoir& other);
+
+  /* Get the sampled fragments, in random order */
+  void GetFragments(std::vector<Fragment>* output_fragments) const;
+
+  void SetCapacity(const std::size_t& _capacity) {capacity = _capacity;}
+  std::size_t NumSeen() const {return num_seen;}
+  std::size_t Size() const {return entries.size();}
+  void Clear();
+
+ private:
+  struct Entry {
+    double key;
+    Fragment frag;
+    Entry(const double& _key, const Fragment& _frag) : key(_key), frag(_frag) {}
+  };
+  static bool EntryLess(const Entry& a, const Entry& b);
+
+  void AddEntry(const Entry& entry);
+
+  std::size_t capacity;
+  std::size_t num_seen;
+  std::vector<Entry> entries; // max-heap on key
+};
+
+#endif  // SRC_FRAGMENT_RESERVOIR_H__
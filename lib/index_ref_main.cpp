@@ -0,0 +1,85 @@
+#include <cstring>
+#include <iostream>
+#include <stdlib.h>
+
+#include "common.h"
+#include "options.h"
+#include "packed_genome.h"
+#include "chipsConfig.h"
+
+using namespace std;
+
+// define our parameter checking macro
+#define PARAMETER_CHECK(param, paramLen, actualLen) (strncmp(argv[i], param, min(actualLen, paramLen))== 0) && (actualLen == paramLen)
+
+// Function declarations
+void index_ref_help(void);
+
+int index_ref_main(int argc, char* argv[]) {
+  bool showHelp = false;
+  Options options;
+
+  // check to see if we should print out some help
+  if(argc <= 1) showHelp = true;
+  for(int i = 1; i < argc; i++) {
+    int parameterLength = (int)strlen(argv[i]);
+
+    if ((PARAMETER_CHECK("-h", 2, parameterLength)) ||
+       (PARAMETER_CHECK("--help", 6, parameterLength))) {
+      showHelp = true;
+    }
+  }
+  if (showHelp) {index_ref_help();}
+
+  for (int i = 1; i<argc; i++) {
+    int parameterLength = (int)strlen(argv[i]);
+    if (PARAMETER_CHECK("-f", 2, parameterLength)) {
+      if ((i+1) < argc) {
+	options.reffa = argv[i+1];
+	i++;
+      }
+    } else if (PARAMETER_CHECK("-o", 2, parameterLength)) {
+      if ((i+1) < argc) {
+	options.outprefix = argv[i+1];
+	i++;
+      }
+    } else {
+      cerr << endl << "******ERROR: Unrecognized parameter: " << argv[i] << " ******" << endl << endl;
+      index_ref_help();
+    }
+  }
+
+  if (options.reffa.empty()) {
+    cerr << "****** ERROR: Must specify reffa with -f ******" << endl;
+    index_ref_help();
+  }
+  if (options.outprefix.empty()) {
+    options.outprefix = options.reffa + ".chipsref";
+  }
+  if (PackedGenome::IsImage(options.reffa)) {
+    PrintMessageDieOnError(options.reffa + " is already a reference image", M_ERROR);
+  }
+
+  PrintMessageDieOnError("Loading " + options.reffa, M_PROGRESS);
+  PackedGenome packed_genome(options.reffa);
+  PrintMessageDieOnError("Writing reference image to " + options.outprefix, M_PROGRESS);
+  packed_genome.WriteImage(options.outprefix);
+  return 0;
+}
+
+void index_ref_help(void) {
+  cerr << "\nTool:    chips index-ref" << endl;
+  cerr << "Version: " << chips_VERSION_MAJOR << "." << chips_VERSION_MINOR << "\n";
+  cerr << "Summary: Write a reference image that simreads -f maps into memory instead of reading the FASTA." << endl << endl;
+  cerr << "Usage:   " << PROGRAM_NAME << " index-ref -f ref.fa [-o ref.fa.chipsref]" << endl << endl;
+  cerr << "[Required arguments]: " << "\n";
+  cerr << "         -f <ref.fa>:        FASTA file with reference genome (.fai index required)" << "\n";
+  cerr << "[Optional arguments]: " << "\n";
+  cerr << "         -o <file>:          Reference image to write\n"
+       << "                             Default: <ref.fa>.chipsref\n";
+  cerr << "\n";
+  cerr  << "[ General help ]:" << endl;
+  cerr  << "    --help        "  << "Print this help menu.\n";
+  cerr << "\n";
+  exit(1);
+}
@@ -15,6 +15,7 @@
 #include "model.h"
 #include "options.h"
 #include "peak_loader.h"
+#include "run_stats.h"
 #include "fragment.h"
 #include "chipsConfig.h"
 
@@ -616,6 +617,11 @@ int learn_main(int argc, char* argv[]) {
       options.paired = true;
     } else if (PARAMETER_CHECK("--output-frag-lens", 18, parameterLength)) {
       options.output_frag_lens = true;
+    } else if (PARAMETER_CHECK("--stats-json", 12, parameterLength)) {
+      if ((i+1) < argc) {
+        options.stats_json = argv[i+1];
+        i++;
+      }
     } else if (PARAMETER_CHECK("--est", 5, parameterLength)){
       if ((i+1) < argc){
         options.estimate_frag_length = std::atoi(argv[i+1]);
@@ -644,9 +650,11 @@ int learn_main(int argc, char* argv[]) {
   if (!showHelp) {
     /***************** Main implementation ***************/
     ChIPModel model;
+    RunStats run_stats("learn");
 
     /*** Learn fragment size disbribution parameters ***/
     PrintMessageDieOnError("Learning fragment size distribution", M_PROGRESS);
+    StageTimer frag_timer;
     float frag_param_a = -1;
     float frag_param_b = -1;
     if (options.paired){
@@ -662,9 +670,12 @@ int learn_main(int argc, char* argv[]) {
       }
     }
     model.SetFrag(frag_param_a, frag_param_b);
+    frag_timer.Stop();
+    run_stats.AddThread("frag", frag_timer);
     
     /*** Learn pulldown ratio parameters ***/
     PrintMessageDieOnError("Learning pulldown parameters", M_PROGRESS);
+    StageTimer pulldown_timer;
     float ab_ratio;
     float s = -1;
     float f = -1;
@@ -674,19 +685,28 @@ int learn_main(int argc, char* argv[]) {
     }
     model.SetF(f);
     model.SetS(s);
+    pulldown_timer.Stop();
+    run_stats.AddThread("pulldown", pulldown_timer);
 
     /*** Learn PCR geometric distribution parameter **/
     PrintMessageDieOnError("Learning PCR parameters", M_PROGRESS);
+    StageTimer pcr_timer;
     float geo_rate = -1;
     if (!learn_pcr(options.chipbam, &geo_rate)){
       PrintMessageDieOnError("Error learning PCR rate", M_ERROR);
     }
     model.SetPCR(geo_rate);
+    pcr_timer.Stop();
+    run_stats.AddThread("pcr", pcr_timer);
 
     /*** Output learned model **/
     PrintMessageDieOnError("Output model", M_PROGRESS);
     model.WriteModel(options.outprefix + ".json");
     model.PrintModel();
+    if (!options.stats_json.empty()) {
+      PrintMessageDieOnError("Writing run statistics to " + options.stats_json, M_PROGRESS);
+      run_stats.WriteJson(options.stats_json);
+    }
     return 0;
   } else {
     learn_help();
@@ -714,6 +734,7 @@ void learn_help(void) {
        << "                             Default: " <<options.estimate_frag_length<< "\n";
   cerr << "         --noscale:          Don't scale peak scores by the max score.\n";                   
   cerr << "         --scale-outliers:   Set all peaks with scores >2*median score to have binding prob 1. Recommended with real data\n";
+  cerr << "         --stats-json <file>: Write wall and CPU time per learning step and peak memory to file\n";
   cerr << "[BAM-file arguments]: " << "\n";
   cerr << "         --paired:           Loading paired-end reads\n"
        << "                             Default: false\n";
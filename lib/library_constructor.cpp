@@ -6,11 +6,18 @@ LibraryConstructor::LibraryConstructor(const Options& options) {
 
 // Apply PCR
 void LibraryConstructor::Perform(const vector<Fragment>& input_fragments,
-				 vector<Fragment>* output_fragments, std::mt19937& rng) {
+				 vector<Fragment>* output_fragments, SimRng& rng) {
   for (int frag_index=0; frag_index<input_fragments.size(); frag_index++){
     output_fragments->push_back(input_fragments[frag_index]);
   }
 }
 
+// Stream fragments into a sample bounded by the read budget
+void LibraryConstructor::Perform(const vector<Fragment>& input_fragments,
+				 FragmentReservoir* output_reservoir, SimRng& rng) {
+  for (int frag_index=0; frag_index<input_fragments.size(); frag_index++){
+    output_reservoir->Add(input_fragments[frag_index], rng);
+  }
+}
 
 LibraryConstructor::~LibraryConstructor() {}
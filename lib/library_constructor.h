@@ -2,6 +2,7 @@
 #define SRC_LIBRARY_CONSTRUCTOR_H__
 
 #include "fragment.h"
+#include "fragment_reservoir.h"
 #include "options.h"
 
 #include <vector>
@@ -15,7 +16,9 @@ class LibraryConstructor {
   virtual ~LibraryConstructor();
 
   void Perform(const vector<Fragment>& input_fragments,
-	       vector<Fragment>* output_fragments, std::mt19937& rng);
+	       vector<Fragment>* output_fragments, SimRng& rng);
+  void Perform(const vector<Fragment>& input_fragments,
+	       FragmentReservoir* output_reservoir, SimRng& rng);
 
  private:
   float pcr_rate;
@@ -1,23 +1,121 @@
 #include "multithread.h"
 
+#include <chrono>
+#include <cstdint>
+
 template <typename T>
-T TaskQueue <T> ::pop(){
-  std::unique_lock<std::mutex> mlock(_mutex);
-  if (_queue.empty()){
-    throw std::out_of_range("Task queue is empty now. All jobs have been finished");
+BoundedQueue <T> ::BoundedQueue(size_t capacity){
+  // Round up to a power of two so positions map to cells with a mask
+  size_t size = 2;
+  while (size < capacity) size <<= 1;
+  _cells.reset(new Cell[size]);
+  for (size_t i=0; i<size; i++){
+    _cells[i].sequence.store(i, std::memory_order_relaxed);
   }
-  auto item = _queue.front();
-  _queue.pop();
-  mlock.unlock();
-  return item;
+  _mask = size-1;
+  _enqueue_pos.store(0, std::memory_order_relaxed);
+  _dequeue_pos.store(0, std::memory_order_relaxed);
+  _closed.store(false, std::memory_order_relaxed);
 }
 
+template <typename T>
+bool BoundedQueue <T> ::TryPush(T& item){
+  size_t pos = _enqueue_pos.load(std::memory_order_relaxed);
+  Cell* cell;
+  while (true){
+    cell = &_cells[pos & _mask];
+    size_t seq = cell->sequence.load(std::memory_order_acquire);
+    intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+    if (diff == 0){
+      if (_enqueue_pos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) break;
+    } else if (diff < 0){
+      return false; // full
+    } else {
+      pos = _enqueue_pos.load(std::memory_order_relaxed);
+    }
+  }
+  cell->data = std::move(item);
+  cell->sequence.store(pos+1, std::memory_order_release);
+  return true;
+}
 
 template <typename T>
-void TaskQueue <T> ::push(const T& item){
-  std::unique_lock<std::mutex> mlock(_mutex);
-  _queue.push(std::move(item));
-  mlock.unlock();
+bool BoundedQueue <T> ::TryPop(T& item){
+  size_t pos = _dequeue_pos.load(std::memory_order_relaxed);
+  Cell* cell;
+  while (true){
+    cell = &_cells[pos & _mask];
+    size_t seq = cell->sequence.load(std::memory_order_acquire);
+    intptr_t diff = (intptr_t) seq - (intptr_t) (pos+1);
+    if (diff == 0){
+      if (_dequeue_pos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) break;
+    } else if (diff < 0){
+      return false; // empty
+    } else {
+      pos = _dequeue_pos.load(std::memory_order_relaxed);
+    }
+  }
+  item = std::move(cell->data);
+  cell->sequence.store(pos+_mask+1, std::memory_order_release);
+  return true;
+}
+
+template <typename T>
+void BoundedQueue <T> ::Push(T& item, double* wait_seconds){
+  if (TryPush(item)) return;
+  // Only look at the clock when we actually have to wait
+  std::chrono::steady_clock::time_point wait_start = std::chrono::steady_clock::now();
+  int spins = 0;
+  do {
+    backoff(spins);
+  } while (!TryPush(item));
+  add_wait(wait_start, wait_seconds);
+}
+
+template <typename T>
+bool BoundedQueue <T> ::Pop(T& item, double* wait_seconds){
+  if (TryPop(item)) return true;
+  std::chrono::steady_clock::time_point wait_start = std::chrono::steady_clock::now();
+  int spins = 0;
+  bool popped;
+  while (!(popped = TryPop(item))){
+    if (_closed.load(std::memory_order_acquire)){
+      // Items pushed before Close() are visible now
+      popped = TryPop(item);
+      break;
+    }
+    backoff(spins);
+  }
+  add_wait(wait_start, wait_seconds);
+  return popped;
+}
+
+template <typename T>
+void BoundedQueue <T> ::Close(){
+  _closed.store(true, std::memory_order_release);
+}
+
+/*
+  Spin briefly, then yield, then sleep: stages wait on each other for
+  whole genome copies, so there is no point burning a core meanwhile
+*/
+template <typename T>
+void BoundedQueue <T> ::backoff(int& spins){
+  spins++;
+  if (spins < 16){
+    return;
+  } else if (spins < 32){
+    std::this_thread::yield();
+  } else {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+template <typename T>
+void BoundedQueue <T> ::add_wait(const std::chrono::steady_clock::time_point& wait_start, double* wait_seconds){
+  if (wait_seconds != NULL) {
+    *wait_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - wait_start).count();
+  }
 }
 
 template <typename T>
@@ -26,4 +124,3 @@ void TaskVector <T> ::push_back(const T& item){
   _vec.push_back(std::move(item));
   mlock.unlock();
 }
-
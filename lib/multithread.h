@@ -5,24 +5,87 @@
 #ifndef THREAD_QUEUE_H_
 #define THREAD_QUEUE_H_
 
+#include <stdlib.h>
+
 #include <queue>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
+#include <chrono>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
 
+/*
+  Bounded multi-producer multi-consumer queue connecting the stages of a
+  pipeline. Push and pop are lock-free (one compare-and-swap on a ticket
+  counter plus a per-slot sequence number). Blocking Push/Pop back off
+  while the queue is full/empty, so a slow stage throttles the stages
+  feeding it. Once Close() is called and the queue drained, Pop returns false.
+*/
 template <typename T>
-class TaskQueue{
+class BoundedQueue{
   public:
-    T pop();
-    void push(const T& item);
+    explicit BoundedQueue(size_t capacity);
+
+    bool TryPush(T& item);   // moves item into the queue on success
+    bool TryPop(T& item);
+    // Blocking versions wait while the queue is full (Push) or empty and
+    // open (Pop). Time spent waiting is added to wait_seconds if given
+    void Push(T& item, double* wait_seconds=NULL);
+    bool Pop(T& item, double* wait_seconds=NULL);
+    void Close();            // no more items will be pushed
 
   private:
-    std::queue<T> _queue;
-    std::mutex _mutex;
+    struct Cell {
+      std::atomic<size_t> sequence;
+      T data;
+    };
+    std::unique_ptr<Cell[]> _cells;
+    size_t _mask;
+    alignas(64) std::atomic<size_t> _enqueue_pos;
+    alignas(64) std::atomic<size_t> _dequeue_pos;
+    std::atomic<bool> _closed;
+
+    static void backoff(int& spins);
+    static void add_wait(const std::chrono::steady_clock::time_point& wait_start, double* wait_seconds);
 };
 
 
+/*
+  C++11 operator new only aligns to alignof(std::max_align_t), less than
+  BoundedQueue asks for to keep its positions on separate cache lines,
+  so make queues on the heap with MakeAligned instead of new
+*/
+template <typename T>
+struct AlignedDelete{
+  void operator()(T* object) const {
+    object->~T();
+    free(object);
+  }
+};
+
+template <typename T>
+using AlignedPtr = std::unique_ptr<T, AlignedDelete<T> >;
+
+template <typename T, typename... Args>
+AlignedPtr<T> MakeAligned(Args&&... args){
+  void* memory = NULL;
+  size_t alignment = (alignof(T) > sizeof(void*)) ? alignof(T) : sizeof(void*);
+  if (posix_memalign(&memory, alignment, sizeof(T)) != 0) {
+    throw std::bad_alloc();
+  }
+  try {
+    return AlignedPtr<T>(new (memory) T(std::forward<Args>(args)...));
+  } catch (...) {
+    free(memory);
+    throw;
+  }
+}
+
+
 template <typename T>
 class TaskVector{
   public:
@@ -0,0 +1,108 @@
+#include <ctype.h>
+
+#include <algorithm>
+
+#include "common.h"
+#include "n_run_index.h"
+#include "packed_genome.h"
+#include "ref_genome.h"
+
+using namespace std;
+
+NRunIndex::NRunIndex(const std::string& _reffa, const std::string& _chrom) {
+  if (PackedGenome::IsImage(_reffa)) {
+    PackedGenome image(_reffa);
+    vector<string> chroms;
+    vector<pair<int32_t, int32_t> > runs;
+    image.GetChroms(&chroms);
+    for (size_t i=0; i<chroms.size(); i++) {
+      if (!_chrom.empty() && chroms[i] != _chrom) continue;
+      image.GetRuns(chroms[i], 'n', MIN_RUN_LENGTH, &runs);
+      for (size_t j=0; j<runs.size(); j++) {
+	Run run = {runs[j].first, runs[j].second};
+	chrom_runs[chroms[i]].push_back(run);
+      }
+    }
+    return;
+  }
+
+  FastaReader fasta(_reffa);
+  const vector<FastaIndexEntry>& entries = fasta.GetEntries();
+  for (size_t i=0; i<entries.size(); i++) {
+    if (!_chrom.empty() && entries[i].name != _chrom) continue;
+    vector<Run> runs;
+    int32_t pos = 0;
+    int32_t run_start = -1;
+    fasta.ReadBases(entries[i], [&](const char* bases, size_t count) {
+	for (size_t j=0; j<count; j++, pos++) {
+	  bool is_n = (toupper(bases[j]) == 'N');
+	  if (is_n && run_start < 0) {
+	    run_start = pos;
+	  } else if (!is_n && run_start >= 0) {
+	    if (pos-run_start >= MIN_RUN_LENGTH) {
+	      Run run = {run_start, pos};
+	      runs.push_back(run);
+	    }
+	    run_start = -1;
+	  }
+	}
+      });
+    if (run_start >= 0 && pos-run_start >= MIN_RUN_LENGTH) {
+      Run run = {run_start, pos};
+      runs.push_back(run);
+    }
+    if (!runs.empty()) {
+      chrom_runs[entries[i].name].swap(runs);
+    }
+  }
+}
+
+const std::vector<NRunIndex::Run>* NRunIndex::GetRuns(const std::string& chrom) const {
+  map<string, vector<Run> >::const_iterator it = chrom_runs.find(chrom);
+  if (it == chrom_runs.end()) {
+    return NULL;
+  }
+  return &it->second;
+}
+
+int32_t NRunIndex::GetRunEnd(const std::vector<Run>* runs, const int32_t& pos) {
+  if (runs == NULL) {
+    return pos;
+  }
+  // The last run starting at or before pos
+  Run key = {pos, pos};
+  vector<Run>::const_iterator it =
+    std::upper_bound(runs->begin(), runs->end(), key,
+		     [](const Run& a, const Run& b) {return a.start < b.start;});
+  if (it == runs->begin()) {
+    return pos;
+  }
+  it--;
+  return (it->end > pos) ? it->end : pos;
+}
+
+bool NRunIndex::IsAllN(const std::vector<Run>* runs, const int32_t& start, const int32_t& end) {
+  return (end > start) && (GetRunEnd(runs, start) >= end);
+}
+
+bool NRunIndex::HasAllNRead(const std::vector<Run>* runs, const int32_t& start, const int& length,
+			    const int& readlen) {
+  if (runs == NULL) {
+    return false;
+  }
+  int32_t frag_end = start+length+1;
+  int32_t read_length = std::min(readlen, length+1);
+  return IsAllN(runs, start, start+read_length) || IsAllN(runs, frag_end-read_length, frag_end);
+}
+
+int64_t NRunIndex::TotalLength() const {
+  int64_t total = 0;
+  for (map<string, vector<Run> >::const_iterator it = chrom_runs.begin(); it != chrom_runs.end(); it++) {
+    for (size_t i=0; i<it->second.size(); i++) {
+      total += it->second[i].end - it->second[i].start;
+    }
+  }
+  return total;
+}
+
+NRunIndex::~NRunIndex() {}
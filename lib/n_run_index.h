@@ -0,0 +1,53 @@
+#ifndef SRC_N_RUN_INDEX_H__
+#define SRC_N_RUN_INDEX_H__
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+class NRunIndex {
+  /*
+    Where the reference is all N (assembly gaps, centromeres), so
+    simulation can skip them: bins that are all N get no bins, shearing
+    jumps over runs of N, and fragments whose reads would be all N are
+    dropped. Built at startup from the FASTA, or taken from a reference
+    image, which already has the runs. Runs shorter than MIN_RUN_LENGTH
+    are left out, they can't hold a whole read anyway.
+   */
+ public:
+  /* Only index _chrom, if given */
+  NRunIndex(const std::string& _reffa, const std::string& _chrom = "");
+  virtual ~NRunIndex();
+
+  static const int32_t MIN_RUN_LENGTH = 20;
+
+  // A run of N, [start, end)
+  struct Run {
+    int32_t start;
+    int32_t end;
+  };
+
+  /* Runs of a chromosome sorted by start, or NULL if it has none */
+  const std::vector<Run>* GetRuns(const std::string& chrom) const;
+
+  /* End of the run of N covering pos, or pos if there is none */
+  static int32_t GetRunEnd(const std::vector<Run>* runs, const int32_t& pos);
+
+  /* Whether [start, end) is all N */
+  static bool IsAllN(const std::vector<Run>* runs, const int32_t& start, const int32_t& end);
+
+  /* Whether a read from either end of the fragment at start would be all N.
+     Fragments are sequenced from start to start+length, inclusive */
+  static bool HasAllNRead(const std::vector<Run>* runs, const int32_t& start, const int& length,
+			  const int& readlen);
+
+  /* Total number of bases in runs */
+  int64_t TotalLength() const;
+
+ private:
+  std::map<std::string, std::vector<Run> > chrom_runs;
+};
+
+#endif  // SRC_N_RUN_INDEX_H__
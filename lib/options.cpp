@@ -25,10 +25,27 @@ Options::Options() {
   readlen = 36;
   paired = false;
   n_threads = 1;
+  sequence_threads = 0;
+  format_threads = 1;
+  write_threads = 1;
+  stream_reads = false;
+  packed_reference = false;
+  engine = "shear";
+  exact_pulldown = false;
+  keep_gaps = false;
+  keep_shards = false;
+  resume = false;
+  shard_index = 0;
+  num_shards = 1;
+  merge_shards = 0;
+  gzip_output = false;
+  bam_output = false;
+  compress_threads = 1;
 
   // Simulation model parameters
   gamma_k = 15.67;
   gamma_theta = 15.49;
+  frag_lens_file = "";
   ratio_s = 0.17594;
   ratio_f = 0.03713;
   pcr_rate = 1.0;
@@ -61,6 +78,8 @@ Options::Options() {
 
   // Other options
   verbose = false;
+  stats_json = "";
+  trace_json = "";
 }
 
 Options::~Options() {}
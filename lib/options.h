@@ -28,14 +28,31 @@ class Options {
 
   // Simulation experiment parameters
   int numcopies;
-  int numreads;
+  std::int64_t numreads;
   int readlen;
   bool paired;
   int n_threads;
+  int sequence_threads;
+  int format_threads;
+  int write_threads;
+  bool stream_reads;
+  bool packed_reference;
+  std::string engine;
+  bool exact_pulldown;
+  bool keep_gaps;
+  bool keep_shards;
+  bool resume;
+  int shard_index;
+  int num_shards;
+  int merge_shards;
+  bool gzip_output;
+  bool bam_output;
+  int compress_threads;
 
   // Simulation model parameters
   float gamma_k;
   float gamma_theta;
+  std::string frag_lens_file;
   float ratio_s;
   float ratio_f;
   float pcr_rate; 
@@ -60,6 +77,8 @@ class Options {
 
   // Other options
   bool verbose;
+  std::string stats_json;
+  std::string trace_json;
 };
 
 #endif  // SRC_OPTIONS_H__
@@ -0,0 +1,302 @@
+#include <ctype.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "common.h"
+#include "packed_genome.h"
+#include "ref_genome.h"
+#include "run_stats.h"
+
+using namespace std;
+
+namespace {
+const char PackedBases[] = {'a', 'c', 'g', 't'};
+
+// The four bases held by each possible byte
+struct UnpackTable {
+  char bases[256][4];
+  UnpackTable() {
+    for (int byte=0; byte<256; byte++) {
+      for (int i=0; i<4; i++) {
+	bases[byte][i] = PackedBases[(byte >> (2*i)) & 3];
+      }
+    }
+  }
+};
+const UnpackTable unpack_table;
+
+// Image layout: header, contig table, then names, packed bases and
+// runs of each contig, every section starting on an 8 byte boundary
+const char ImageMagic[8] = {'C', 'H', 'I', 'P', 'S', 'R', 'E', 'F'};
+const int64_t ImageVersion = 1;
+
+struct ImageHeader {
+  char magic[8];
+  int64_t version;
+  int64_t num_contigs;
+};
+
+struct ImageContig {
+  int64_t name_offset;
+  int64_t name_length;
+  int64_t length;
+  int64_t packed_offset;
+  int64_t runs_offset;
+  int64_t num_runs;
+};
+
+int64_t Align8(const int64_t& offset) {
+  return (offset+7) & ~((int64_t) 7);
+}
+
+int BaseCode(const char& base) {
+  switch (base) {
+  case 'a': return 0;
+  case 'c': return 1;
+  case 'g': return 2;
+  case 't': return 3;
+  default: return -1;
+  }
+}
+}
+
+PackedGenome::PackedGenome(const std::string& _reffa) {
+  image = NULL;
+  image_size = 0;
+  if (IsImage(_reffa)) {
+    MapImage(_reffa);
+  } else {
+    LoadFasta(_reffa);
+  }
+  for (size_t i=0; i<contigs.size(); i++) {
+    contig_index[contigs[i].name] = (int) i;
+  }
+}
+
+bool PackedGenome::IsImage(const std::string& filename) {
+  char magic[sizeof(ImageMagic)];
+  ifstream input(filename.c_str(), ios::binary);
+  return input.read(magic, sizeof(magic)) && memcmp(magic, ImageMagic, sizeof(magic)) == 0;
+}
+
+void PackedGenome::LoadFasta(const std::string& _reffa) {
+  FastaReader fasta(_reffa);
+  const std::vector<FastaIndexEntry>& entries = fasta.GetEntries();
+  contigs.resize(entries.size());
+  for (size_t i=0; i<entries.size(); i++) {
+    contigs[i].name = entries[i].name;
+    contigs[i].length = entries[i].length;
+    LoadContig(fasta, entries[i], &contigs[i]);
+  }
+  // Point into the backing memory once the contigs stop moving
+  for (size_t i=0; i<contigs.size(); i++) {
+    contigs[i].packed = contigs[i].packed_data.data();
+    contigs[i].runs = contigs[i].runs_data.data();
+    contigs[i].num_runs = contigs[i].runs_data.size();
+  }
+}
+
+void PackedGenome::LoadContig(FastaReader& fasta, const FastaIndexEntry& entry, Contig* contig) {
+  contig->packed_data.assign((contig->length+3)/4, 0);
+  contig->runs_data.clear();
+  int64_t pos = 0;
+  fasta.ReadBases(entry, [&](const char* bases, size_t count) {
+      for (size_t i=0; i<count; i++, pos++) {
+	char base = tolower(bases[i]);
+	int code = BaseCode(base);
+	if (code >= 0) {
+	  contig->packed_data[pos >> 2] |= (uint8_t) (code << (2*(pos & 3)));
+	} else if (!contig->runs_data.empty() && contig->runs_data.back().base == base &&
+		   contig->runs_data.back().start+contig->runs_data.back().length == pos) {
+	  contig->runs_data.back().length++;
+	} else {
+	  BaseRun run = {pos, 1, base, {0, 0, 0}};
+	  contig->runs_data.push_back(run);
+	}
+      }
+    });
+  vector<BaseRun>(contig->runs_data).swap(contig->runs_data);
+}
+
+void PackedGenome::MapImage(const std::string& filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    PrintMessageDieOnError("Failed to open reference image " + filename, M_ERROR);
+  }
+  image_size = st.st_size;
+  image = (image_size < sizeof(ImageHeader)) ? MAP_FAILED :
+    mmap(NULL, image_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (image == MAP_FAILED) {
+    image = NULL;
+    PrintMessageDieOnError("Failed to map reference image " + filename, M_ERROR);
+  }
+  const char* base = static_cast<const char*>(image);
+  const ImageHeader* header = reinterpret_cast<const ImageHeader*>(base);
+  if (header->version != ImageVersion) {
+    PrintMessageDieOnError("Reference image " + filename + " was written by another version of chips, "
+			   "rerun chips index-ref", M_ERROR);
+  }
+  const ImageContig* table = reinterpret_cast<const ImageContig*>(base + sizeof(ImageHeader));
+  if (header->num_contigs < 0 ||
+      (size_t) (sizeof(ImageHeader) + header->num_contigs*sizeof(ImageContig)) > image_size) {
+    PrintMessageDieOnError("Reference image " + filename + " is truncated", M_ERROR);
+  }
+  contigs.resize(header->num_contigs);
+  for (int64_t i=0; i<header->num_contigs; i++) {
+    const ImageContig& entry = table[i];
+    if ((size_t) (entry.name_offset+entry.name_length) > image_size ||
+	(size_t) (entry.packed_offset+(entry.length+3)/4) > image_size ||
+	(size_t) (entry.runs_offset+entry.num_runs*sizeof(BaseRun)) > image_size) {
+      PrintMessageDieOnError("Reference image " + filename + " is truncated", M_ERROR);
+    }
+    contigs[i].name.assign(base + entry.name_offset, entry.name_length);
+    contigs[i].length = entry.length;
+    contigs[i].packed = reinterpret_cast<const uint8_t*>(base + entry.packed_offset);
+    contigs[i].runs = reinterpret_cast<const BaseRun*>(base + entry.runs_offset);
+    contigs[i].num_runs = entry.num_runs;
+  }
+}
+
+void PackedGenome::WriteImage(const std::string& filename) const {
+  // Lay out the sections, then write them in order
+  std::vector<ImageContig> table(contigs.size());
+  int64_t offset = Align8(sizeof(ImageHeader) + contigs.size()*sizeof(ImageContig));
+  for (size_t i=0; i<contigs.size(); i++) {
+    table[i].name_offset = offset;
+    table[i].name_length = contigs[i].name.size();
+    table[i].length = contigs[i].length;
+    table[i].packed_offset = Align8(table[i].name_offset + table[i].name_length);
+    table[i].runs_offset = Align8(table[i].packed_offset + (contigs[i].length+3)/4);
+    table[i].num_runs = contigs[i].num_runs;
+    offset = Align8(table[i].runs_offset + contigs[i].num_runs*sizeof(BaseRun));
+  }
+  ImageHeader header;
+  memcpy(header.magic, ImageMagic, sizeof(ImageMagic));
+  header.version = ImageVersion;
+  header.num_contigs = contigs.size();
+
+  ofstream output(filename.c_str(), ios::binary | ios::trunc);
+  const char padding[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+  int64_t written = 0;
+  auto write_at = [&](const int64_t& at, const void* data, const int64_t& size) {
+    output.write(padding, at-written);
+    output.write(static_cast<const char*>(data), size);
+    written = at+size;
+  };
+  write_at(0, &header, sizeof(header));
+  write_at(written, table.data(), table.size()*sizeof(ImageContig));
+  for (size_t i=0; i<contigs.size(); i++) {
+    write_at(table[i].name_offset, contigs[i].name.data(), table[i].name_length);
+    write_at(table[i].packed_offset, contigs[i].packed, (contigs[i].length+3)/4);
+    write_at(table[i].runs_offset, contigs[i].runs, contigs[i].num_runs*sizeof(BaseRun));
+  }
+  output.write(padding, offset-written);
+  output.close();
+  if (!output) {
+    PrintMessageDieOnError("Failed to write " + filename, M_ERROR);
+  }
+}
+
+bool PackedGenome::GetSequence(const std::string& _chrom,
+			       const int32_t& _start,
+			       const int32_t& _end,
+			       std::string* seq) const {
+  int64_t fetch_start = MonotonicNanoseconds();
+  map<string, int>::const_iterator it = contig_index.find(_chrom);
+  if (it == contig_index.end()) {
+    stringstream ss;
+    ss << "Error fetching reference sequence for " << _chrom << ":" << _start;
+    PrintMessageDieOnError(ss.str(), M_ERROR);
+  }
+  const Contig& contig = contigs[it->second];
+  // Clamp the same way faidx does
+  int64_t start = _start;
+  int64_t end = _end;
+  if (end < start) start = end;
+  start = std::max((int64_t) 0, std::min(start, contig.length-1));
+  end = std::max((int64_t) 0, std::min(end, contig.length-1));
+  if (contig.length == 0) end = start-1;
+  int64_t length = end-start+1;
+  seq->resize(length);
+  char* out = &(*seq)[0];
+
+  // Whole bytes where possible, then fix up the bases not in a/c/g/t
+  int64_t pos = start;
+  for (; pos <= end && (pos & 3) != 0; pos++) {
+    *out++ = unpack_table.bases[contig.packed[pos >> 2]][pos & 3];
+  }
+  for (; pos+3 <= end; pos += 4, out += 4) {
+    memcpy(out, unpack_table.bases[contig.packed[pos >> 2]], 4);
+  }
+  for (; pos <= end; pos++) {
+    *out++ = unpack_table.bases[contig.packed[pos >> 2]][pos & 3];
+  }
+  BaseRun first = {start, 0, 0, {0, 0, 0}};
+  const BaseRun* runs_end = contig.runs + contig.num_runs;
+  const BaseRun* run =
+    std::upper_bound(contig.runs, runs_end, first,
+		     [](const BaseRun& a, const BaseRun& b) {return a.start < b.start;});
+  if (run != contig.runs) run--;
+  for (; run != runs_end && run->start <= end; run++) {
+    int64_t run_start = std::max(run->start, start);
+    int64_t run_end = std::min(run->start+run->length-1, end);
+    for (int64_t i=run_start; i<=run_end; i++) {
+      (*seq)[i-start] = run->base;
+    }
+  }
+
+  StatCounters& counters = ThreadStatCounters();
+  counters.bases_fetched += length;
+  counters.fetch_nanoseconds += MonotonicNanoseconds() - fetch_start;
+  return true;
+}
+
+void PackedGenome::GetChroms(std::vector<std::string>* chroms) const {
+  chroms->clear();
+  for (size_t i=0; i<contigs.size(); i++) {
+    chroms->push_back(contigs[i].name);
+  }
+}
+
+void PackedGenome::GetLengths(std::map<std::string, int>* chromLengths) const {
+  for (size_t i=0; i<contigs.size(); i++) {
+    (*chromLengths)[contigs[i].name] = (int) contigs[i].length;
+  }
+}
+
+void PackedGenome::GetRuns(const std::string& chrom, const char& base, const int64_t& min_length,
+			   std::vector<std::pair<int32_t, int32_t> >* runs) const {
+  runs->clear();
+  map<string, int>::const_iterator it = contig_index.find(chrom);
+  if (it == contig_index.end()) return;
+  const Contig& contig = contigs[it->second];
+  for (int64_t i=0; i<contig.num_runs; i++) {
+    if (contig.runs[i].base == base && contig.runs[i].length >= min_length) {
+      runs->push_back(std::make_pair((int32_t) contig.runs[i].start,
+				     (int32_t) (contig.runs[i].start+contig.runs[i].length)));
+    }
+  }
+}
+
+int64_t PackedGenome::MemoryBytes() const {
+  int64_t bytes = 0;
+  for (size_t i=0; i<contigs.size(); i++) {
+    bytes += (contigs[i].length+3)/4 + contigs[i].num_runs*sizeof(BaseRun);
+  }
+  return bytes;
+}
+
+PackedGenome::~PackedGenome() {
+  if (image != NULL) {
+    munmap(image, image_size);
+  }
+}
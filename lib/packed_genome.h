@@ -0,0 +1,81 @@
+#ifndef SRC_PACKED_GENOME_H__
+#define SRC_PACKED_GENOME_H__
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+class FastaReader;
+struct FastaIndexEntry;
+
+class PackedGenome {
+  /*
+    The whole reference in memory, 2 bits per base, for all threads to
+    fetch from without going back to the FASTA. Bases other than a/c/g/t
+    (mostly runs of N) are kept in a side table of runs. Read-only once
+    loaded, so it's safe to share between threads.
+
+    It is either loaded from a FASTA file and its .fai, or mapped from
+    an image written by WriteImage (chips index-ref). Mapped images are
+    shared through the page cache by all processes using them
+   */
+ public:
+  PackedGenome(const std::string& _reffa);
+  virtual ~PackedGenome();
+
+  /* Whether the file is an image written by WriteImage */
+  static bool IsImage(const std::string& filename);
+
+  /* Write the packed bases, side table and contig table to an image */
+  void WriteImage(const std::string& filename) const;
+
+  /* Same as RefGenome::GetSequence: bases _start to _end (inclusive, clamped
+     to the chromosome), lower case. Reuses the memory of seq */
+  bool GetSequence(const std::string& _chrom,
+		   const int32_t& _start,
+		   const int32_t& _end,
+		   std::string* seq) const;
+
+  /* Chromosomes in the order of the FASTA, and their lengths */
+  void GetChroms(std::vector<std::string>* chroms) const;
+  void GetLengths(std::map<std::string, int>* chromLengths) const;
+
+  /* Runs of at least min_length of the (lower case) base on a chromosome,
+     as [start, end) */
+  void GetRuns(const std::string& chrom, const char& base, const int64_t& min_length,
+	       std::vector<std::pair<int32_t, int32_t> >* runs) const;
+
+  /* Bytes held by the packed bases and the side table */
+  int64_t MemoryBytes() const;
+
+ private:
+  // A run of the same base that isn't a/c/g/t. Stored as is in images
+  struct BaseRun {
+    int64_t start;
+    int32_t length;
+    char base;
+    char unused[3];
+  };
+  struct Contig {
+    std::string name;
+    int64_t length;
+    const uint8_t* packed;       // 4 bases per byte, the first in the low bits
+    const BaseRun* runs;         // sorted by start
+    int64_t num_runs;
+    std::vector<uint8_t> packed_data; // backing memory when loaded from a FASTA
+    std::vector<BaseRun> runs_data;
+  };
+
+  std::vector<Contig> contigs;
+  std::map<std::string, int> contig_index;
+  void* image;       // the mapped image, if any
+  size_t image_size;
+
+  void LoadFasta(const std::string& _reffa);
+  void LoadContig(FastaReader& fasta, const FastaIndexEntry& entry, Contig* contig);
+  void MapImage(const std::string& filename);
+};
+
+#endif  // SRC_PACKED_GENOME_H__
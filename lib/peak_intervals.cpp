@@ -1,6 +1,10 @@
 #include "common.h"
 #include "peak_intervals.h"
 #include "ref_genome.h"
+#include "run_stats.h"
+
+#include <algorithm>
+#include <limits>
 
 PeakIntervals::PeakIntervals(const Options& options, const std::string peakfile, const std::string peakfileType,
 			     const std::string bamfile, const std::int32_t count_colidx) {
@@ -40,57 +44,65 @@ bool PeakIntervals::LoadPeaks(const Options& options,
     for (int peakIndex=0; peakIndex<peaks.size(); peakIndex++){
       peak_map[peaks[peakIndex].chrom].push_back(peaks[peakIndex]);
     }
+    // index the peaks of each chromosome for overlap queries
+    for (std::map<std::string, std::vector<Fragment> >::const_iterator it = peak_map.begin();
+         it != peak_map.end(); it++) {
+      contig_ids[it->first] = (int) contigs.size();
+      contigs.push_back(PeakContig());
+      IndexContig(it->second, &contigs.back());
+    }
   }
   return dataLoaded;
 }
 
 /*
- * Inputs:
- *   - Fragment frag: a fragment
- *   - std::vector<Fragment>: a list of peaks
- *
- * Outputs:
- *   - float: probablity of the input fragment being bound
- * */
-float PeakIntervals::SearchList(const Fragment& frag, int& peakIndexStart){
-  std::vector<float> probBoundList;
-  std::int32_t frag_start, frag_end, peak_start, peak_end;
-  float overlap;
-  std::vector<Fragment> & peaks = peak_map[frag.chrom];
-  for(int peakIndex=peakIndexStart; peakIndex < peaks.size(); peakIndex++){
-    if (frag.chrom == peaks[peakIndex].chrom){
-      frag_start = frag.start;
-      frag_end = frag.start+frag.length;
-      peak_start = peaks[peakIndex].start;
-      peak_end = peaks[peakIndex].start+peaks[peakIndex].length;
-
-      if (frag_end <= peak_start){
-        break; // there remain no overlapped peaks
-      }else if(frag_start >= peak_end){
-        peakIndexStart += 1; // move to the next peak
-      }else{
-        overlap = (float) (std::min(peak_end,frag_end) - std::max(peak_start, frag_start)) / (float)(frag_end-frag_start);
-        probBoundList.push_back(overlap*peaks[peakIndex].score);
-      }
-    }else{
-        std::cerr << "****** ERROR: Unexpected errors in PeakInterval/SearchList ******" << std::endl;
-        std::exit(1);
-    }
+  Build the implicit interval tree of a chromosome's peaks (cgranges'
+  index_core). Leaves are the even indices; the node at index i of level
+  k has children i-2^(k-1) and i+2^(k-1). Right children past the last
+  peak don't exist, and take the max end of the last existing subtree
+ */
+void PeakIntervals::IndexContig(const std::vector<Fragment>& peaks, PeakContig* contig) {
+  std::vector<Fragment> sorted_peaks(peaks);
+  std::stable_sort(sorted_peaks.begin(), sorted_peaks.end(),
+		   [](const Fragment& a, const Fragment& b) {return a.start < b.start;});
+  std::int64_t n = sorted_peaks.size();
+  std::int32_t running_max = 0;
+  for (std::int64_t i=0; i<n; i++) {
+    contig->starts.push_back(sorted_peaks[i].start);
+    contig->ends.push_back(sorted_peaks[i].start+sorted_peaks[i].length);
+    contig->scores.push_back(sorted_peaks[i].score);
+    running_max = std::max(running_max, contig->ends.back());
+    contig->running_max_end.push_back(running_max);
+  }
+  contig->subtree_max_end = contig->ends;
+  contig->root_level = -1;
+  if (n == 0) return;
+
+  std::vector<std::int32_t>& max_end = contig->subtree_max_end;
+  std::int64_t last_i = 0;
+  std::int32_t last = 0;
+  for (std::int64_t i=0; i<n; i+=2) {
+    last_i = i;
+    last = max_end[i];
   }
-  
-  // suppose probBoundList = [a, b, c]
-  // result = 1- (1-a)*(1-b)*(1-c)
-  if (probBoundList.size() > 0){
-    //std::cout<<"found"<<std::endl;
-    float probBound = 1;
-    for (int peakIndex=0; peakIndex < probBoundList.size(); peakIndex++){
-       probBound *= (1-probBoundList[peakIndex]);
+  int k;
+  for (k=1; ((std::int64_t) 1 << k) <= n; k++) {
+    std::int64_t x = (std::int64_t) 1 << (k-1);
+    for (std::int64_t i=(x<<1)-1; i<n; i+=x<<2) {
+      std::int32_t left = max_end[i-x];
+      std::int32_t right = (i+x < n) ? max_end[i+x] : last;
+      max_end[i] = std::max(contig->ends[i], std::max(left, right));
     }
-    probBound = 1-probBound;
-    return probBound;
-  }else{
-    return 0;
+    // move last_i up to its parent, and keep last the max end of its subtree
+    last_i = ((last_i >> k) & 1) ? last_i-x : last_i+x;
+    if (last_i < n && max_end[last_i] > last) last = max_end[last_i];
   }
+  contig->root_level = k-1;
+}
+
+int PeakIntervals::GetContigId(const std::string& chrom) const {
+  std::map<std::string, int>::const_iterator it = contig_ids.find(chrom);
+  return (it == contig_ids.end()) ? -1 : it->second;
 }
 
 /*
@@ -99,12 +111,91 @@ float PeakIntervals::SearchList(const Fragment& frag, int& peakIndexStart){
 
   Outputs:
   - float: probability that the fragment is bound
+  - float* score_sum: if not NULL, set to the sum of overlap*score over all peaks
 
   If the fragment doesn't overlap a peak, return 0
-  If it overlaps one ore more peak, return the max score across all peaks
+  If it overlaps peaks with probabilities a, b, c (overlap*score),
+  return 1-(1-a)*(1-b)*(1-c)
  */
-float PeakIntervals::GetOverlap(const Fragment& frag, int& peakIndexStart) {
-  float score = SearchList(frag, peakIndexStart);
-  return score;
+float PeakIntervals::GetOverlap(const Fragment& frag, float* score_sum) const {
+  return GetOverlap(GetContigId(frag.chrom), frag.start, frag.length, score_sum);
 }
 
+float PeakIntervals::GetOverlap(const int& contig_id, const std::int32_t& start, const std::int32_t& length,
+				float* score_sum) const {
+  ThreadStatCounters().overlap_queries++;
+  if (score_sum != NULL) *score_sum = 0;
+  if (contig_id < 0) {
+    return 0;
+  }
+  const PeakContig& contig = contigs[contig_id];
+  std::int64_t n = contig.starts.size();
+  std::int32_t frag_start = start;
+  std::int32_t frag_end = start+length;
+  float probUnbound = 1;
+  bool found = false;
+  auto add_peak = [&](const std::int64_t& i) {
+    float overlap = (float) (std::min(contig.ends[i], frag_end) - std::max(contig.starts[i], frag_start)) /
+      (float) (frag_end-frag_start);
+    probUnbound *= (1-overlap*contig.scores[i]);
+    if (score_sum != NULL) *score_sum += overlap*contig.scores[i];
+    found = true;
+  };
+
+  // Walk the tree in order (so peaks are visited by start), skipping
+  // subtrees that end before the fragment or start after it. Subtrees
+  // of 15 or fewer peaks are scanned instead
+  struct Node {
+    std::int64_t x;
+    int k;
+    bool left_done;
+  };
+  Node stack[64];
+  int t = 0;
+  stack[t++] = {((std::int64_t) 1 << contig.root_level) - 1, contig.root_level, false};
+  while (t > 0) {
+    Node z = stack[--t];
+    if (z.k <= 3) {
+      std::int64_t i0 = z.x >> z.k << z.k;
+      std::int64_t i1 = std::min(i0 + ((std::int64_t) 1 << (z.k+1)) - 1, n);
+      for (std::int64_t i=i0; i<i1 && contig.starts[i] < frag_end; i++) {
+	if (frag_start < contig.ends[i]) add_peak(i);
+      }
+    } else if (!z.left_done) {
+      std::int64_t y = z.x - ((std::int64_t) 1 << (z.k-1));
+      stack[t++] = {z.x, z.k, true};
+      if (y >= n || contig.subtree_max_end[y] > frag_start) {
+	stack[t++] = {y, z.k-1, false};
+      }
+    } else if (z.x < n && contig.starts[z.x] < frag_end) {
+      if (frag_start < contig.ends[z.x]) add_peak(z.x);
+      stack[t++] = {z.x + ((std::int64_t) 1 << (z.k-1)), z.k-1, false};
+    }
+  }
+  return found ? 1-probUnbound : 0;
+}
+
+/*
+  Inputs:
+  - int contig_id: peaks of the chromosome, from GetContigId
+  - int32_t pos: position
+
+  Outputs:
+  - int32_t: any fragment starting at or after pos and ending at or before
+             the returned position overlaps no peak. Equal to pos if a peak
+             covers pos, and the max int32 value if no peaks lie ahead.
+ */
+std::int32_t PeakIntervals::GetPeakFreeEnd(const int& contig_id, const std::int32_t& pos) const {
+  if (contig_id < 0) {
+    return std::numeric_limits<std::int32_t>::max();
+  }
+  // Every peak before the first one whose running max end is past pos
+  // ends at or before pos
+  const PeakContig& contig = contigs[contig_id];
+  size_t peakIndex = std::upper_bound(contig.running_max_end.begin(), contig.running_max_end.end(), pos)
+    - contig.running_max_end.begin();
+  if (peakIndex >= contig.starts.size()) {
+    return std::numeric_limits<std::int32_t>::max();
+  }
+  return std::max(pos, contig.starts[peakIndex]);
+}
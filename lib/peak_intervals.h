@@ -17,19 +17,46 @@ class PeakIntervals {
 		const std::int32_t count_colidx);
   virtual ~PeakIntervals();
 
-  /* Get score of peak overlapping fragment */
-  float GetOverlap(const Fragment& frag, int& peakIndexStart);
-  void resetSearchScope(const int index);
+  /* Get score of peak overlapping fragment. Queries can come in any
+     order, from any thread */
+  float GetOverlap(const Fragment& frag, float* score_sum=NULL) const;
+  /* Same, for the fragment [start, start+length) on a contig from GetContigId */
+  float GetOverlap(const int& contig_id, const std::int32_t& start, const std::int32_t& length,
+		   float* score_sum=NULL) const;
+  /* Get the id of the peaks of a chromosome, -1 if it has none */
+  int GetContigId(const std::string& chrom) const;
+  /* Get the end of the peak-free stretch starting at pos */
+  std::int32_t GetPeakFreeEnd(const int& contig_id, const std::int32_t& pos) const;
+  /* Get all peaks, keyed by chromosome */
+  const std::map<std::string, std::vector<Fragment> >& GetPeaks() const {return peak_map;}
   float total_bound_length;
   float total_genome_length;
 
  private:
   // peakmap:  key: chromID,  data: fragments
   std::map<std::string, std::vector<Fragment> > peak_map;
+
+  /*
+    Peaks of one chromosome as an implicit interval tree: peaks sorted by
+    start, the one at index i at level (number of trailing 1 bits of i)
+    of a complete binary tree laid out in order, with the max end of each
+    node's subtree alongside (Li 2020, cgranges). Never changes once built
+   */
+  struct PeakContig {
+    std::vector<std::int32_t> starts;
+    std::vector<std::int32_t> ends;
+    std::vector<float> scores;
+    std::vector<std::int32_t> subtree_max_end;
+    std::vector<std::int32_t> running_max_end; // of this peak and those before it
+    int root_level;
+  };
+  std::vector<PeakContig> contigs;
+  std::map<std::string, int> contig_ids;
+
   /* Load peaks from file */
   bool LoadPeaks(const Options& options, const std::string peakfile, const std::string peakfileType, const std::string bamfile,
 		 const std::int32_t count_colidx);
-  float SearchList(const Fragment& frag, int& peakIndexStart);
+  void IndexContig(const std::vector<Fragment>& peaks, PeakContig* contig);
 };
 
 #endif  // SRC_PEAKINTERVALS_H__
@@ -4,68 +4,124 @@
 #include <iostream>
 #include <random>
 
-Pulldown::Pulldown(const Options& options, const GenomeBin& gbin,\
-        std::string& _prev_chrom, int& _peakIndexStart, int& _start_offset) {
-  chrom = gbin.chrom;
+Pulldown::Pulldown(const Options& options, const BinTable& bins, const size_t& bin_index,
+		   const FragmentLengths& _frag_lengths, const NRunIndex* nrun_index)
+  : chrom(bins.GetChrom(bins[bin_index])), frag_lengths(_frag_lengths) {
+  const GenomeBin& gbin = bins[bin_index];
   start = gbin.start;
   end = gbin.end;
+  contig_start = gbin.contig_start;
   numcopies = options.numcopies;
-  gamma_k = options.gamma_k;
-  gamma_theta = options.gamma_theta;
   ratio_beta = options.ratio_f*(1-options.ratio_s)/(options.ratio_s*(1-options.ratio_f));
+  fast_background = (!options.exact_pulldown && ratio_beta > 0 && ratio_beta < 1);
+  readlen = options.readlen;
+  nruns = (nrun_index != NULL) ? nrun_index->GetRuns(chrom) : NULL;
+}
+
+/*
+  Inputs:
+  - SimRng rng: random number generator for this bin
+
+  Outputs:
+  - int32_t: distance from the bin start to the first fragment starting in the bin
+
+  Shearing is a renewal process, so the bin start falls inside a fragment
+  whose length is size-biased (Gamma(k+1, theta) for Gamma(k, theta)
+  lengths) at a uniform position.
+  Drawing the offset this way lets every bin be sheared independently
+  instead of carrying the overhang of the previous bin forward.
+ */
+std::int32_t Pulldown::SampleStartOffset(SimRng& rng) {
+  if (contig_start) {
+    return 0;
+  }
+  return SampleOverhang(rng);
+}
 
-  prev_chrom = _prev_chrom;
-  peakIndexStart = _peakIndexStart;
-  start_offset_ptr = & _start_offset;
+/*
+  The part of a fragment covering a point left after that point. Also
+  where shearing picks up again after a run of N
+ */
+std::int32_t Pulldown::SampleOverhang(SimRng& rng) {
+  return (std::int32_t) std::round(rng.Uniform()*frag_lengths.SampleCovering(rng));
 }
 
-void Pulldown::Perform(vector<Fragment>* output_fragments, PeakIntervals* pintervals, std::mt19937& rng) {
+void Pulldown::Perform(vector<Fragment>* output_fragments, PeakIntervals* pintervals, SimRng& rng) {
   // Set up
   //unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
   //std::default_random_engine generator(seed);
-  std::gamma_distribution<float> fragdist(gamma_k, gamma_theta);
   std::int32_t current_pos;
-  std::int32_t fstart, fend;
   int fsize;
   bool bound;
   float peak_score;
 
+  /*
+    Away from peaks a fragment is only kept with probability ratio_beta.
+    Instead of a keep draw and a peak query for every fragment there,
+    draw how many fragments are thrown away before the next kept one
+    (geometric) and only draw the lengths of those. The first fragment
+    that runs past the peak-free stretch is scored like any other, and
+    the count is dropped, which is fine since it is memoryless: given
+    the fragments so far were thrown away, the count left is the same
+    geometric again.
+  */
+  std::geometric_distribution<int> skipdist(fast_background ? ratio_beta : 0.5);
+  std::int32_t peak_free_end = 0; // fragments ending at or before this overlap no peak
+  int skipped;
 
-  // update the start index of peaks
-  if (chrom != prev_chrom){
-    peakIndexStart = 0;
-    prev_chrom = chrom;
-  }
-
-  // Perform separate shearing for each copy of the genome
-  // pintervals->resetSearchScope(peakIndexStart); 
-  int peakIndex = peakIndexStart;
-  current_pos = start + *start_offset_ptr;
-  // Break up into fragment lengths drawn from gamma distribution
+  // Overlap queries below all go to this chromosome's peaks
+  int peak_contig_id = pintervals->GetContigId(chrom);
+  current_pos = start + SampleStartOffset(rng);
+  // Break up into fragments with lengths drawn from frag_lengths
+  // The last fragment may run past the end of the bin
   while (current_pos < end) {
-    fsize = (int) std::round(fragdist(rng));
-    fstart = current_pos; fend = current_pos+fsize;
-    if (fend > end) {
-      if (fstart < end){
-        *start_offset_ptr = fend-end;
-      }else{
-        break;
+    // Nothing is sequenced from a run of N, so shear on from its end
+    std::int32_t n_run_end = NRunIndex::GetRunEnd(nruns, current_pos);
+    if (n_run_end > current_pos) {
+      current_pos = n_run_end + SampleOverhang(rng);
+      continue;
+    }
+
+    fsize = -1; // not drawn yet
+    if (fast_background) {
+      if (current_pos >= peak_free_end) {
+        peak_free_end = pintervals->GetPeakFreeEnd(peak_contig_id, current_pos);
+      }
+      if (current_pos < peak_free_end) {
+        skipped = skipdist(rng);
+        while (true) {
+          fsize = frag_lengths.Sample(rng);
+          if (current_pos + fsize > peak_free_end) break; // may overlap a peak, score it below
+          if (skipped == 0 && !NRunIndex::HasAllNRead(nruns, current_pos, fsize, readlen)) {
+            output_fragments->push_back(Fragment(chrom, current_pos, fsize));
+          }
+          current_pos += fsize;
+          fsize = -1;
+          if (skipped-- == 0 || current_pos >= end ||
+              NRunIndex::GetRunEnd(nruns, current_pos) > current_pos) break;
+        }
+        if (fsize < 0) continue;
       }
     }
-    Fragment frag(chrom, current_pos, fsize);
-    peak_score = pintervals->GetOverlap(frag, peakIndex);
 
-    bound = ( ((float) rng()/(float) rng.max()) < peak_score);
+    if (fsize < 0) {
+      fsize = frag_lengths.Sample(rng);
+    }
+    if (NRunIndex::HasAllNRead(nruns, current_pos, fsize, readlen)) {
+      current_pos += fsize;
+      continue;
+    }
+    peak_score = pintervals->GetOverlap(peak_contig_id, current_pos, fsize);
+
+    bound = (rng.Uniform() < peak_score);
     if (bound) {
-      output_fragments->push_back(frag);
+      output_fragments->push_back(Fragment(chrom, current_pos, fsize));
     } else{
-      if ( ((float) rng()/(float) rng.max()) < ratio_beta) {
-          output_fragments->push_back(frag);
+      if (rng.Uniform() < ratio_beta) {
+          output_fragments->push_back(Fragment(chrom, current_pos, fsize));
       }
     }
     current_pos += fsize;
   }
-
-  peakIndexStart = peakIndex;
 }
 
@@ -3,8 +3,11 @@
 
 #include "bingenerator.h"
 #include "fragment.h"
+#include "fragment_lengths.h"
+#include "n_run_index.h"
 #include "options.h"
 #include "peak_intervals.h"
+#include "sim_rng.h"
 
 #include <vector>
 #include <random>
@@ -12,22 +15,25 @@
 
 class Pulldown {
  public:
-  Pulldown(const Options& options, const GenomeBin& gbin,
-            std::string& _prev_chrom, int& _peakIndexStart, int& _start_offset);
-  void Perform(vector<Fragment>* output_fragments, PeakIntervals* pintervals, std::mt19937& rng);
+  /* Runs of N in nrun_index are skipped, if given */
+  Pulldown(const Options& options, const BinTable& bins, const size_t& bin_index,
+	   const FragmentLengths& _frag_lengths, const NRunIndex* nrun_index = NULL);
+  void Perform(vector<Fragment>* output_fragments, PeakIntervals* pintervals, SimRng& rng);
 
  private:
-  std::string chrom;
+  const std::string& chrom;
   std::int32_t start;
   std::int32_t end;
+  bool contig_start;
   int numcopies;
-  float gamma_k, gamma_theta;
+  const FragmentLengths& frag_lengths;
   float ratio_beta;
+  bool fast_background;
   bool debug_pulldown;
+  int readlen;
+  const std::vector<NRunIndex::Run>* nruns; // of this chromosome, NULL if none
 
-  int peakIndexStart;
-  std::string prev_chrom;
-  int* start_offset_ptr;
-  unsigned seed;
+  std::int32_t SampleStartOffset(SimRng& rng);
+  std::int32_t SampleOverhang(SimRng& rng);
 };
 #endif  // SRC_PULLDOWN_H__
@@ -1,20 +1,78 @@
 #include <stdlib.h>
 
 #include <iostream>
+#include <fstream>
 #include <sstream>
 #include <algorithm>
 
 #include "common.h"
 #include "ref_genome.h"
+#include "run_stats.h"
 
 using namespace std;
 
+namespace {
+/*
+  Each line of the index is: name, length, offset of the first base,
+  bases per line and bytes per line
+*/
+void ReadFastaIndex(const std::string& _reffa, std::vector<FastaIndexEntry>* entries) {
+  ifstream index((_reffa + ".fai").c_str());
+  if (!index.good()) {
+    PrintMessageDieOnError("No index for FASTA file " + _reffa, M_ERROR);
+  }
+  entries->clear();
+  string line;
+  while (getline(index, line)) {
+    if (line.empty()) continue;
+    istringstream fields(line);
+    FastaIndexEntry entry;
+    if (!(getline(fields, entry.name, '\t') &&
+	  fields >> entry.length >> entry.offset >> entry.line_bases >> entry.line_width) ||
+	entry.line_bases <= 0 || entry.line_width < entry.line_bases) {
+      PrintMessageDieOnError("Malformed FASTA index line: " + line, M_ERROR);
+    }
+    entries->push_back(entry);
+  }
+}
+
+/* Read all bases of one sequence of a plain FASTA, without the line ends */
+void ReadFastaBases(std::istream& fasta, const FastaIndexEntry& entry,
+		    const std::function<void(const char*, size_t)>& add_bases) {
+  fasta.clear();
+  fasta.seekg(entry.offset);
+  // Read whole lines at a time, and hand on the bases of each line
+  vector<char> buffer(entry.line_width*std::max((int64_t) 1, (int64_t) (1 << 20)/entry.line_width));
+  int64_t remaining = entry.length;
+  while (remaining > 0) {
+    fasta.read(buffer.data(), buffer.size());
+    streamsize nread = fasta.gcount();
+    if (nread <= 0) {
+      PrintMessageDieOnError("FASTA file ends before the lengths in its index", M_ERROR);
+    }
+    for (streamsize line_start=0; line_start<nread && remaining>0; line_start+=entry.line_width) {
+      int64_t count = std::min(std::min((int64_t) (nread-line_start), entry.line_bases), remaining);
+      add_bases(buffer.data()+line_start, count);
+      remaining -= count;
+    }
+  }
+}
+}
+
 RefGenome::RefGenome(const std::string& _reffa) {
+  refindex = NULL;
+  image = NULL;
   // Check if file exists
   if (!file_exists(_reffa)) {
     PrintMessageDieOnError("FASTA file " + _reffa + " does not exist", M_ERROR);
   }
 
+  // A reference image needs no index
+  if (PackedGenome::IsImage(_reffa)) {
+    image = new PackedGenome(_reffa);
+    return;
+  }
+
   // Check for index
   if (!file_exists(_reffa + ".fai")) {
     PrintMessageDieOnError("No index for FASTA file " + _reffa, M_ERROR);
@@ -31,7 +89,11 @@ bool RefGenome::GetSequence(const std::string& _chrom,
 			    const int32_t& _start,
 			    const int32_t& _end,
 			    std::string* seq) {
+  if (image != NULL) {
+    return image->GetSequence(_chrom, _start, _end, seq);
+  }
   int length;
+  std::int64_t fetch_start = MonotonicNanoseconds();
   char* result = faidx_fetch_seq(refindex, _chrom.c_str(), _start, _end, &length);
   if (result == NULL) {
     stringstream ss;
@@ -41,6 +103,9 @@ bool RefGenome::GetSequence(const std::string& _chrom,
   seq->assign(result, length);
   std::transform(seq->begin(), seq->end(), seq->begin(), ::tolower);
   free((void *)result);
+  StatCounters& counters = ThreadStatCounters();
+  counters.bases_fetched += length;
+  counters.fetch_nanoseconds += MonotonicNanoseconds() - fetch_start;
   return true;
 }
 
@@ -56,6 +121,10 @@ bool RefGenome::GetSequence(const std::string& _chrom,
 */
 
 bool RefGenome::GetChroms(vector<string>* chroms) {
+  if (image != NULL) {
+    image->GetChroms(chroms);
+    return true;
+  }
   chroms->clear();
   int nseqs = faidx_nseq(refindex);
   for (int i=0; i<nseqs; i++) {
@@ -76,6 +145,10 @@ bool RefGenome::GetChroms(vector<string>* chroms) {
    Get a map of {chromosomes, total lengths} from the reference genome.
 */
 bool RefGenome::GetLengths(map<string, int>* chromLengths) {
+  if (image != NULL) {
+    image->GetLengths(chromLengths);
+    return true;
+  }
   vector<string> chroms;
   if (!GetChroms(&chroms)) {
     return false;
@@ -87,8 +160,57 @@ bool RefGenome::GetLengths(map<string, int>* chromLengths) {
   return true;
 }
 
+FastaReader::FastaReader(const std::string& _reffa) {
+  refindex = NULL;
+  fasta.open(_reffa.c_str(), ios::binary);
+  if (!fasta.good()) {
+    PrintMessageDieOnError("FASTA file " + _reffa + " does not exist", M_ERROR);
+  }
+  ReadFastaIndex(_reffa, &entries);
+  // gzip magic
+  if (fasta.get() == 0x1f && fasta.get() == 0x8b) {
+    fasta.close();
+    refindex = fai_load(_reffa.c_str());
+    if (refindex == NULL) {
+      PrintMessageDieOnError("Failed to load the index of compressed FASTA file " + _reffa +
+			     ". It must be compressed with bgzip and have a .gzi index", M_ERROR);
+    }
+  }
+}
+
+void FastaReader::ReadBases(const FastaIndexEntry& entry,
+			    const std::function<void(const char*, size_t)>& add_bases) {
+  if (refindex == NULL) {
+    ReadFastaBases(fasta, entry, add_bases);
+    return;
+  }
+  // faidx takes int positions, so fetch a window at a time
+  const int64_t window = 1 << 20;
+  for (int64_t start=0; start<entry.length; start+=window) {
+    int64_t stop = std::min(start+window, entry.length);
+    int length;
+    char* bases = faidx_fetch_seq(refindex, entry.name.c_str(), (int) start, (int) (stop-1), &length);
+    if (bases == NULL || length != stop-start) {
+      stringstream ss;
+      ss << "Error fetching reference sequence for " << entry.name << ":" << start;
+      PrintMessageDieOnError(ss.str(), M_ERROR);
+    }
+    add_bases(bases, length);
+    free(bases);
+  }
+}
+
+FastaReader::~FastaReader() {
+  if (refindex != NULL) {
+    fai_destroy(refindex);
+  }
+}
+
 RefGenome::~RefGenome() {
-  fai_destroy(refindex);
+  if (refindex != NULL) {
+    fai_destroy(refindex);
+  }
+  delete image;
 }
 
 int64_t RefGenome::GetGenomeLength() {
@@ -2,15 +2,57 @@
 #define SRC_REF_GENOME_H__
 
 #include "htslib/faidx.h"
+#include "packed_genome.h"
 
 #include <stdint.h>
 #include <unistd.h>
 
+#include <fstream>
+#include <functional>
 #include <map>
 #include <vector>
 #include <string>
 
+// One line of a FASTA index (.fai)
+struct FastaIndexEntry {
+  std::string name;
+  int64_t length;     // bases
+  int64_t offset;     // of the first base in the FASTA
+  int64_t line_bases; // bases per line
+  int64_t line_width; // bytes per line
+};
+
+class FastaReader {
+  /*
+    Reads whole sequences of an indexed FASTA, one after another. Plain
+    FASTA is read straight from the file at the offsets in its .fai.
+    Those are offsets into the uncompressed text, so bgzipped FASTA
+    (with a .gzi index) is read through faidx instead
+   */
+ public:
+  FastaReader(const std::string& _reffa);
+  virtual ~FastaReader();
+
+  /* The sequences, in the order of the FASTA */
+  const std::vector<FastaIndexEntry>& GetEntries() const {return entries;}
+
+  /* Read all bases of one sequence, without the line ends, and pass
+     them on a chunk at a time to add_bases(bases, count) */
+  void ReadBases(const FastaIndexEntry& entry,
+		 const std::function<void(const char*, size_t)>& add_bases);
+
+ private:
+  std::ifstream fasta;
+  faidx_t* refindex; // if bgzipped
+  std::vector<FastaIndexEntry> entries;
+};
+
 class RefGenome {
+  /*
+    Fetches reference sequence from a FASTA file with a .fai index, or
+    from a reference image written by chips index-ref, which is mapped
+    into memory instead of read
+   */
  public:
   RefGenome(const std::string& _reffa);
   virtual ~RefGenome();
@@ -31,6 +73,7 @@ class RefGenome {
   }
 
   faidx_t* refindex;
+  PackedGenome* image; // if _reffa is a reference image
 };
 
 #endif  // SRC_REF_GENOME_H__
@@ -0,0 +1,174 @@
+#include "run_stats.h"
+#include "common.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <sys/resource.h>
+#include <time.h>
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+namespace {
+const std::chrono::steady_clock::time_point program_start = std::chrono::steady_clock::now();
+
+double seconds_since_start() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - program_start).count();
+}
+
+double thread_cpu_seconds() {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+    return 0;
+  }
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+json counters_json(const StatCounters& counters) {
+  json cjson;
+  cjson["fragments_pulled_down"] = counters.fragments_pulled_down;
+  cjson["fragments_retained"] = counters.fragments_retained;
+  cjson["overlap_queries"] = counters.overlap_queries;
+  cjson["bases_fetched"] = counters.bases_fetched;
+  cjson["fetch_seconds"] = counters.fetch_nanoseconds*1e-9;
+  cjson["reads_written"] = counters.reads_written;
+  cjson["bytes_written"] = counters.bytes_written;
+  return cjson;
+}
+}
+
+StatCounters::StatCounters() {
+  fragments_pulled_down = 0;
+  fragments_retained = 0;
+  overlap_queries = 0;
+  bases_fetched = 0;
+  fetch_nanoseconds = 0;
+  reads_written = 0;
+  bytes_written = 0;
+}
+
+void StatCounters::Add(const StatCounters& other) {
+  fragments_pulled_down += other.fragments_pulled_down;
+  fragments_retained += other.fragments_retained;
+  overlap_queries += other.overlap_queries;
+  bases_fetched += other.bases_fetched;
+  fetch_nanoseconds += other.fetch_nanoseconds;
+  reads_written += other.reads_written;
+  bytes_written += other.bytes_written;
+}
+
+void StatCounters::Subtract(const StatCounters& other) {
+  fragments_pulled_down -= other.fragments_pulled_down;
+  fragments_retained -= other.fragments_retained;
+  overlap_queries -= other.overlap_queries;
+  bases_fetched -= other.bases_fetched;
+  fetch_nanoseconds -= other.fetch_nanoseconds;
+  reads_written -= other.reads_written;
+  bytes_written -= other.bytes_written;
+}
+
+StatCounters& ThreadStatCounters() {
+  static thread_local StatCounters counters;
+  return counters;
+}
+
+std::int64_t MonotonicNanoseconds() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+StageTimer::StageTimer() {
+  wall_start = seconds_since_start();
+  wall_end = wall_start;
+  cpu_start = thread_cpu_seconds();
+  cpu_seconds = 0;
+  idle_seconds = 0;
+  // Counters hold the totals at the start until Stop() takes the difference
+  counters = ThreadStatCounters();
+}
+
+void StageTimer::Stop() {
+  wall_end = seconds_since_start();
+  cpu_seconds = thread_cpu_seconds() - cpu_start;
+  StatCounters at_start = counters;
+  counters = ThreadStatCounters();
+  counters.Subtract(at_start);
+}
+
+RunStats::RunStats(const std::string& _program) {
+  program = _program;
+  wall_start = seconds_since_start();
+}
+
+void RunStats::AddThread(const std::string& stage, const StageTimer& timer) {
+  std::unique_lock<std::mutex> mlock(stats_mutex);
+  if (stage_threads.find(stage) == stage_threads.end()) {
+    stage_names.push_back(stage);
+  }
+  stage_threads[stage].push_back(timer);
+}
+
+void RunStats::WriteJson(const std::string& filename) const {
+  std::unique_lock<std::mutex> mlock(stats_mutex);
+  json report;
+  report["program"] = program;
+  report["wall_seconds"] = seconds_since_start() - wall_start;
+
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    report["cpu_seconds"] = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec*1e-6 +
+      usage.ru_stime.tv_sec + usage.ru_stime.tv_usec*1e-6;
+    report["peak_rss_kb"] = usage.ru_maxrss; // kilobytes on Linux
+  }
+
+  // A stage's wall time runs from its first thread starting to its last
+  // one stopping. CPU, busy and idle time add up over its threads
+  StatCounters total_counters;
+  report["stages"] = json::array();
+  for (size_t stage_index=0; stage_index<stage_names.size(); stage_index++) {
+    const std::vector<StageTimer>& timers = stage_threads.at(stage_names[stage_index]);
+    json sjson;
+    StatCounters stage_counters;
+    double first_start = timers[0].wall_start;
+    double last_end = timers[0].wall_end;
+    double cpu = 0, busy = 0, idle = 0;
+    sjson["per_thread"] = json::array();
+    for (size_t thread_index=0; thread_index<timers.size(); thread_index++) {
+      const StageTimer& timer = timers[thread_index];
+      json tjson;
+      tjson["start_seconds"] = timer.wall_start - wall_start;
+      tjson["wall_seconds"] = timer.WallSeconds();
+      tjson["cpu_seconds"] = timer.cpu_seconds;
+      tjson["busy_seconds"] = timer.BusySeconds();
+      tjson["idle_seconds"] = timer.idle_seconds;
+      sjson["per_thread"].push_back(tjson);
+      first_start = std::min(first_start, timer.wall_start);
+      last_end = std::max(last_end, timer.wall_end);
+      cpu += timer.cpu_seconds;
+      busy += timer.BusySeconds();
+      idle += timer.idle_seconds;
+      stage_counters.Add(timer.counters);
+    }
+    sjson["name"] = stage_names[stage_index];
+    sjson["threads"] = timers.size();
+    sjson["wall_seconds"] = last_end - first_start;
+    sjson["cpu_seconds"] = cpu;
+    sjson["busy_seconds"] = busy;
+    sjson["idle_seconds"] = idle;
+    sjson["counters"] = counters_json(stage_counters);
+    report["stages"].push_back(sjson);
+    total_counters.Add(stage_counters);
+  }
+  report["counters"] = counters_json(total_counters);
+
+  std::ofstream outfile(filename.c_str());
+  outfile << std::setw(4) << report << std::endl;
+  outfile.close();
+  if (!outfile) {
+    PrintMessageDieOnError("Failed to write " + filename, M_ERROR);
+  }
+}
+
+RunStats::~RunStats() {}
@@ -0,0 +1,81 @@
+#ifndef SRC_RUN_STATS_H__
+#define SRC_RUN_STATS_H__
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+  Counts of work done. Every thread has its own set (ThreadStatCounters),
+  so hot code just bumps a plain integer with no locking or atomics
+ */
+struct StatCounters {
+  StatCounters();
+  void Add(const StatCounters& other);
+  void Subtract(const StatCounters& other);
+
+  std::int64_t fragments_pulled_down; // fragments kept by pulldown
+  std::int64_t fragments_retained;    // fragments in the libraries handed to sequencing
+  std::int64_t overlap_queries;       // PeakIntervals::GetOverlap calls
+  std::int64_t bases_fetched;         // reference bases read from the FASTA
+  std::int64_t fetch_nanoseconds;     // wall time spent fetching them
+  std::int64_t reads_written;         // reads (or read pairs) written out
+  std::int64_t bytes_written;         // bytes added to the output files
+};
+
+/* The calling thread's counters */
+StatCounters& ThreadStatCounters();
+
+/* Nanoseconds on a monotonic clock, for timing short calls */
+std::int64_t MonotonicNanoseconds();
+
+class StageTimer {
+  /*
+    Times one thread working on one stage of a run: wall time, the
+    thread's CPU time, and the part of the wall time spent idle waiting
+    for other stages. Counters bumped by the thread in between are
+    attributed to the stage
+   */
+ public:
+  StageTimer();
+
+  void Stop();
+  double WallSeconds() const {return wall_end - wall_start;}
+  double BusySeconds() const {return WallSeconds() - idle_seconds;}
+
+  double wall_start;   // seconds since the program started
+  double wall_end;
+  double cpu_seconds;
+  double idle_seconds; // added to while waiting on a queue
+  StatCounters counters;
+
+ private:
+  double cpu_start;
+};
+
+class RunStats {
+  /*
+    Collects the stage timers of a run and writes them as a JSON report
+    with totals, per stage and per thread figures, and peak memory
+   */
+ public:
+  RunStats(const std::string& _program);
+  virtual ~RunStats();
+
+  /* Add a stopped timer to a stage. Safe to call from any thread */
+  void AddThread(const std::string& stage, const StageTimer& timer);
+
+  /* Write the report */
+  void WriteJson(const std::string& filename) const;
+
+ private:
+  std::string program;
+  double wall_start;
+  std::vector<std::string> stage_names; // in the order first seen
+  std::map<std::string, std::vector<StageTimer> > stage_threads;
+  mutable std::mutex stats_mutex;
+};
+
+#endif  // SRC_RUN_STATS_H__
@@ -23,10 +23,10 @@ const std::map<char, std::vector<char> > Sequencer::SubMap{
                     {'c', {'a','t','g'}},
                     {'g', {'a','t','c'}}};
 
-Sequencer::Sequencer(const Options& options) {
-  ref_genome = new RefGenome(options.reffa);
+Sequencer::Sequencer(const Options& options, const PackedGenome* _packed_genome) {
+  packed_genome = _packed_genome;
+  ref_genome = (packed_genome == NULL) ? new RefGenome(options.reffa) : NULL;
   paired = options.paired;
-  outprefix = options.outprefix;
   readlen = options.readlen;
   pcr_rate = options.pcr_rate;
 
@@ -45,53 +45,79 @@ Sequencer::Sequencer(const Options& options) {
 
 
 void Sequencer::Sequence(const std::vector<Fragment>& input_fragments,
-			 const int& numreads,
-			 int& fastq_index, int thread_index, int copy_index, std::mt19937& rng) {
+			 const std::int64_t& numreads,
+			 const bool& record_truth, SequencedReads* reads,
+			 SimRng& rng) {
   std::string frag_seq;
   std::string read_seq;
   std::string read_seq_rc;
   std::vector<std::string> read_pair;
-  std::vector<std::string> reads_1;
-  std::vector<std::string> reads_2;
-  // std::vector<std::string> chroms;
-  std::vector<std::string> ids;
-  // std::vector<int> starts_1;
-  // std::vector<int> starts_2;
+  std::vector<int> pair_order;
+  ReadPairTruth truth;
+  std::vector<CigarOp>* cigar_forward = record_truth ? &truth.cigar_forward : NULL;
+  std::vector<CigarOp>* cigar_reverse = record_truth ? &truth.cigar_reverse : NULL;
+  std::vector<std::string>& reads_1 = reads->reads_1;
+  std::vector<std::string>& reads_2 = reads->reads_2;
+  std::vector<std::string>& ids = reads->ids;
+  std::vector<ReadPairTruth>& truths = reads->truths;
+  reads_1.clear();
+  reads_2.clear();
+  ids.clear();
+  truths.clear();
 
   // Sample from fragments w/o replacement (by shuffling first)
   // If needed, go through the fragments multiple times
-  int total_reads_sequenced = 0;
+  std::int64_t total_reads_sequenced = 0;
   std::vector<size_t> frag_indices;
   size_t frag_index;
   for (size_t frag_index=0; frag_index<input_fragments.size(); frag_index++) {
     frag_indices.push_back(frag_index);
   }
+  // Sequences of the next batch of fragments, fetched ahead of use
+  std::vector<std::string> batch_seqs;
+  std::vector<bool> batch_fetched;
+  size_t batch_begin = 0;
+  size_t batch_end = 0;
 
-  std::stringstream ss;
-  ss << "Sequencing total reads " << numreads << " for copy " << copy_index;
-  //PrintMessageDieOnError(ss.str(), M_PROGRESS);
   while (true) {
     std::shuffle(frag_indices.begin(), frag_indices.end(), rng);
+    batch_begin = batch_end = 0;
     for (size_t fg=0; fg<frag_indices.size(); fg++) {
+      if (fg == batch_end) {
+	// Each fragment gives at least one read, so don't fetch many more than needed
+	size_t batch_size = (size_t) std::max((std::int64_t) 1, std::min((std::int64_t) FETCH_BATCH_SIZE,
+									 numreads-total_reads_sequenced));
+	batch_begin = fg;
+	batch_end = std::min(frag_indices.size(), fg+batch_size);
+	FetchBatch(input_fragments, frag_indices, batch_begin, batch_end, &batch_seqs, &batch_fetched);
+      }
       frag_index = frag_indices[fg];
-      if(!ref_genome->GetSequence(input_fragments[frag_index].chrom,
-				 input_fragments[frag_index].start,
-				 input_fragments[frag_index].start+input_fragments[frag_index].length,
-				  &frag_seq)) {
+      if (!batch_fetched[fg-batch_begin]) {
 	continue;
       }
+      frag_seq.swap(batch_seqs[fg-batch_begin]);
       // generate reads from both strands
       read_pair.clear();
-      if (Fragment2Read(frag_seq, read_seq, rng) &&
-	  Fragment2Read(ReverseComplement(frag_seq), read_seq_rc, rng)){
-	read_pair.push_back(read_seq);
-	read_pair.push_back(read_seq_rc);
+      if (Fragment2Read(frag_seq, read_seq, rng, cigar_forward, &truth.offset_forward) &&
+	  Fragment2Read(ReverseComplement(frag_seq), read_seq_rc, rng, cigar_reverse, &truth.offset_reverse)){
 	std::stringstream ss;
 	ss << input_fragments[frag_index].chrom << ":"
 	   << input_fragments[frag_index].start << ":"
 	   << input_fragments[frag_index].length;
 	ids.push_back(ss.str());
-	std::shuffle(read_pair.begin(), read_pair.end(), rng);
+	// Shuffle the order of the strands (as indices, so we know which read is which)
+	pair_order = {0, 1};
+	std::shuffle(pair_order.begin(), pair_order.end(), rng);
+	for (size_t i=0; i<pair_order.size(); i++) {
+	  read_pair.push_back(pair_order[i] == 0 ? read_seq : read_seq_rc);
+	}
+	if (record_truth) {
+	  truth.chrom = input_fragments[frag_index].chrom;
+	  truth.start = input_fragments[frag_index].start;
+	  truth.frag_seq_length = frag_seq.size();
+	  truth.first_is_forward = (pair_order[0] == 0);
+	  truths.push_back(truth);
+	}
       }else{
 	continue;
       }
@@ -107,8 +133,9 @@ void Sequencer::Sequence(const std::vector<Fragment>& input_fragments,
       // PCR 
       while (true) {
         if (total_reads_sequenced >= numreads) break;
-        if ( ((float) rng()/(float) rng.max()) < pcr_rate) break;
+        if (rng.Uniform() < pcr_rate) break;
         ids.push_back(ids[ids.size()-1]);
+        if (record_truth) truths.push_back(truths.back());
         reads_1.push_back(read_pair[0]);
         reads_2.push_back(read_pair[1]);
         total_reads_sequenced += 1;
@@ -122,35 +149,120 @@ void Sequencer::Sequence(const std::vector<Fragment>& input_fragments,
       break;
     }
   }
-    
-  // save into file
-  if (paired) {
-    int temp = fastq_index;
-    save_into_fastq(reads_1, ids, outprefix + "_"+std::to_string(thread_index)+"_1.fastq", temp, copy_index);
-    save_into_fastq(reads_2, ids, outprefix + "_"+std::to_string(thread_index)+"_2.fastq", fastq_index, copy_index);
-    //    save_into_sam(reads_1, reads_2, chroms, starts_1, starts_2, outprefix + "/reads_"+std::to_string(thread_index)+".sam");
-  } else{
-    save_into_fastq(reads_1, ids, outprefix + "_"+std::to_string(thread_index)+".fastq", fastq_index, copy_index);
+}
+
+bool Sequencer::FetchSequence(const std::string& chrom, const int32_t& start, const int32_t& end,
+			      std::string* seq) {
+  if (packed_genome != NULL) {
+    return packed_genome->GetSequence(chrom, start, end, seq);
+  }
+  return ref_genome->GetSequence(chrom, start, end, seq);
+}
+
+/*
+   Fetch the sequences of frag_indices[begin, end) into seqs, in that order.
+   Fetching in coordinate order instead of the shuffled order, and fetching
+   nearby fragments in one go, keeps reads from the FASTA sequential
+ */
+void Sequencer::FetchBatch(const std::vector<Fragment>& input_fragments, const std::vector<size_t>& frag_indices,
+			   const size_t& begin, const size_t& end, std::vector<std::string>* seqs,
+			   std::vector<bool>* fetched) {
+  size_t batch_size = end-begin;
+  seqs->resize(batch_size);
+  fetched->assign(batch_size, false);
+  std::vector<size_t> order(batch_size);
+  for (size_t i=0; i<batch_size; i++) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [&](const size_t& a, const size_t& b) {
+      const Fragment& frag_a = input_fragments[frag_indices[begin+a]];
+      const Fragment& frag_b = input_fragments[frag_indices[begin+b]];
+      int cmp = frag_a.chrom.compare(frag_b.chrom);
+      return (cmp != 0) ? (cmp < 0) : (frag_a.start < frag_b.start);
+    });
+
+  std::string window;
+  size_t first = 0;
+  while (first < batch_size) {
+    // Grow the window over the fragments that follow closely
+    const Fragment& first_frag = input_fragments[frag_indices[begin+order[first]]];
+    int32_t window_start = first_frag.start;
+    int32_t window_end = first_frag.start+first_frag.length;
+    size_t last = first+1;
+    for (; last<batch_size; last++) {
+      const Fragment& frag = input_fragments[frag_indices[begin+order[last]]];
+      int32_t frag_end = frag.start+frag.length;
+      if (frag.chrom != first_frag.chrom || frag.start > window_end+FETCH_MERGE_GAP ||
+	  std::max(window_end, frag_end)-window_start > FETCH_MAX_WINDOW) {
+	break;
+      }
+      window_end = std::max(window_end, frag_end);
+    }
+    if (last == first+1) {
+      size_t i = order[first];
+      (*fetched)[i] = FetchSequence(first_frag.chrom, first_frag.start, window_end, &(*seqs)[i]);
+      first = last;
+      continue;
+    }
+    if (!FetchSequence(first_frag.chrom, window_start, window_end, &window)) {
+      first = last;
+      continue;
+    }
+    // The window may be cut short at the end of the chromosome, like each fragment would be
+    for (size_t j=first; j<last; j++) {
+      size_t i = order[j];
+      const Fragment& frag = input_fragments[frag_indices[begin+i]];
+      size_t offset = frag.start-window_start;
+      if (offset >= window.size()) {
+	(*fetched)[i] = FetchSequence(frag.chrom, frag.start, frag.start+frag.length, &(*seqs)[i]);
+      } else {
+	(*seqs)[i].assign(window, offset, frag.length+1);
+	(*fetched)[i] = true;
+      }
+    }
+    first = last;
+  }
+}
+
+/*
+   Add one base of the given CIGAR operation, extending the last run if possible
+ */
+static void push_cigar_op(std::vector<CigarOp>* cigar_ops, char type, int32_t length=1) {
+  if (cigar_ops == NULL) return;
+  if (!cigar_ops->empty() && cigar_ops->back().Type == type) {
+    cigar_ops->back().Length += length;
+  } else {
+    cigar_ops->push_back(CigarOp(type, length));
   }
 }
 
-bool Sequencer::Fragment2Read(const std::string frag, std::string& read, std::mt19937& rng){
+/*
+   Simulate a read from the start of frag.
+   If cigar_ops is given, also record how the read aligns to frag:
+   deletions before the first (after the last) aligned base are dropped,
+   ref_offset is set to the position in frag of the first aligned base.
+ */
+bool Sequencer::Fragment2Read(const std::string frag, std::string& read, SimRng& rng,
+			      std::vector<CigarOp>* cigar_ops, int32_t* ref_offset){
   try{
     //read = frag.substr(0, readlen);
     //if (frag.length() < readlen){ return false;}
     read = "";
+    if (cigar_ops != NULL) cigar_ops->clear();
     double dice;
     int elem_index = 0;
     while (read.size() < readlen){
-      dice = (((float) rng()/(float) rng.max()));
+      dice = rng.Uniform();
       if (dice <= ins_rate){
         // randomly insert a nucleotide
         int ins_index = rng() % 4;
         read += NucleotideTypesUpper[ins_index];
+        push_cigar_op(cigar_ops, 'I');
       }else if (dice <= (ins_rate + del_rate)){
         // skip this nucleotide
         if (elem_index < frag.size()){
           elem_index += 1;
+          push_cigar_op(cigar_ops, 'D');
           continue;
         }else{
           break;
@@ -166,6 +278,7 @@ bool Sequencer::Fragment2Read(const std::string frag, std::string& read, std::mt
             read += (SubMap.at(nuc_to_mut))[sub_index];
           }
           elem_index += 1;
+          push_cigar_op(cigar_ops, 'M');
         }else{
           break;
         }
@@ -174,17 +287,32 @@ bool Sequencer::Fragment2Read(const std::string frag, std::string& read, std::mt
           // correctly sequenced
           read += frag[elem_index];
           elem_index += 1;
+          push_cigar_op(cigar_ops, 'M');
         }else{
           break;
         }
       }
     }
 
+    if (cigar_ops != NULL){
+      int32_t offset = 0;
+      if (!cigar_ops->empty() && cigar_ops->front().Type == 'D'){
+        offset = cigar_ops->front().Length;
+        cigar_ops->erase(cigar_ops->begin());
+      }
+      // a deletion may only be followed by an insertion before the read ran out
+      for (int i=cigar_ops->size()-1; i>=0 && (*cigar_ops)[i].Type != 'M'; i--){
+        if ((*cigar_ops)[i].Type == 'D') cigar_ops->erase(cigar_ops->begin()+i);
+      }
+      if (ref_offset != NULL) *ref_offset = offset;
+    }
+
     if (read.size() < readlen){
       // fill up the reads with "N"s if the fragment length is
       // shorter than the read length
       int N_total = readlen-read.size();
       for (int add_n=0; add_n<N_total; add_n++) read += 'N';
+      push_cigar_op(cigar_ops, 'S', N_total);
       return true;
     }else if (read.size() == readlen){
       return true;
@@ -244,20 +372,85 @@ bool Sequencer::save_into_sam(const std::vector<std::string> reads1,
   return true;
   }*/
 
-bool Sequencer::save_into_fastq(const std::vector<std::string> reads, 
-				const std::vector<std::string> ids,
-				const std::string ofilename,
-				int& fastq_index, int copy_index){
-  std::ofstream ofile(ofilename, std::ofstream::out | std::ofstream::app);
-  for (int read_index=0; read_index<reads.size(); read_index++){
-    ofile << "@SIM:" << ids[read_index] << ":" << copy_index<<":"<< read_index + fastq_index <<"\n";
-    ofile << reads[read_index] << "\n";
-    ofile << "+\n";
-    ofile << std::string(readlen, '~') << "\n";
+void Sequencer::FormatFastq(const SequencedReads& reads, const int& mate, std::string* records){
+  // Format the whole copy, so the writer can append it in one piece
+  const std::vector<std::string>& mate_reads = (mate == 2) ? reads.reads_2 : reads.reads_1;
+  std::string quals(readlen, '~');
+  std::string copy_str = ":" + std::to_string(reads.copy_index) + ":";
+  records->clear();
+  for (size_t read_index=0; read_index<mate_reads.size(); read_index++){
+    *records += "@SIM:";
+    *records += reads.ids[read_index];
+    *records += copy_str;
+    *records += std::to_string(read_index);
+    *records += "\n";
+    *records += mate_reads[read_index];
+    *records += "\n+\n";
+    *records += quals;
+    *records += "\n";
+  }
+}
+
+/*
+   Number of reference bases covered by an alignment
+ */
+static int32_t cigar_ref_span(const std::vector<CigarOp>& cigar_ops) {
+  int32_t span = 0;
+  for (size_t i=0; i<cigar_ops.size(); i++) {
+    if (cigar_ops[i].Type == 'M' || cigar_ops[i].Type == 'D') span += cigar_ops[i].Length;
+  }
+  return span;
+}
+
+void Sequencer::FormatBam(const SequencedReads& reads, const BamHeader* bam_header,
+			  std::vector<BamAlignment>* alignments) {
+  const std::vector<std::string>& reads_1 = reads.reads_1;
+  const std::vector<std::string>& reads_2 = reads.reads_2;
+  alignments->resize(paired ? 2*reads_1.size() : reads_1.size());
+  std::string quals(readlen, '~');
+  std::string copy_str = ":" + std::to_string(reads.copy_index) + ":";
+  int32_t pos[2], end[2];
+  uint16_t flag[2];
+  std::vector<CigarOp> cigars[2];
+  std::string seqs[2];
+  int nreads = paired ? 2 : 1;
+  for (size_t read_index=0; read_index<reads_1.size(); read_index++){
+    const ReadPairTruth& truth = reads.truths[read_index];
+    int32_t ref_id = bam_header->ref_id(truth.chrom);
+    std::string name = "SIM:" + reads.ids[read_index] + copy_str + std::to_string(read_index);
+    for (int mate=0; mate<nreads; mate++){
+      bool forward = (mate == 0) == truth.first_is_forward;
+      const std::string& read = (mate == 0) ? reads_1[read_index] : reads_2[read_index];
+      // reads on the reverse strand are stored reverse complemented
+      if (forward){
+        cigars[mate] = truth.cigar_forward;
+        seqs[mate] = read;
+        pos[mate] = truth.start + truth.offset_forward;
+      } else {
+        cigars[mate].assign(truth.cigar_reverse.rbegin(), truth.cigar_reverse.rend());
+        seqs[mate] = ReverseComplement(read);
+        pos[mate] = truth.start + truth.frag_seq_length - truth.offset_reverse - cigar_ref_span(cigars[mate]);
+      }
+      end[mate] = pos[mate] + cigar_ref_span(cigars[mate]);
+      flag[mate] = forward ? 0 : BAM_FREVERSE;
+      if (ref_id == -1 || end[mate] == pos[mate]) flag[mate] |= BAM_FUNMAP;
+    }
+    if (paired){
+      int32_t tlen = std::max(end[0], end[1]) - std::min(pos[0], pos[1]);
+      for (int mate=0; mate<2; mate++){
+        int other = 1-mate;
+        uint16_t mate_flag = flag[mate] | BAM_FPAIRED | (mate == 0 ? BAM_FREAD1 : BAM_FREAD2);
+        if (flag[other] & BAM_FREVERSE) mate_flag |= BAM_FMREVERSE;
+        if (flag[other] & BAM_FUNMAP) mate_flag |= BAM_FMUNMAP;
+        if (!((flag[0] | flag[1]) & BAM_FUNMAP)) mate_flag |= BAM_FPROPER_PAIR;
+        bool leftmost = (pos[mate] < pos[other]) || (pos[mate] == pos[other] && mate == 0);
+        (*alignments)[2*read_index+mate].SetFields(name, ref_id, pos[mate], mate_flag, 60, cigars[mate], seqs[mate], quals,
+						 ref_id, pos[other], leftmost ? tlen : -tlen);
+      }
+    } else {
+      (*alignments)[read_index].SetFields(name, ref_id, pos[0], flag[0], 60, cigars[0], seqs[0], quals, -1, -1, 0);
+    }
   }
-  ofile.close();
-  fastq_index += reads.size();
-  return true;
 }
 
 Sequencer::~Sequencer() {
@@ -1,26 +1,63 @@
 #ifndef SRC_SEQUENCER_H__
 #define SRC_SEQUENCER_H__
 
+#include "bam_io.h"
 #include "fragment.h"
 #include "options.h"
+#include "packed_genome.h"
 #include "ref_genome.h"
+#include "sim_rng.h"
 #include <vector>
 #include <iostream>
 #include <fstream>
 #include <algorithm>
 #include <random>
 
+// Where the two reads of a sequenced fragment align, for truth BAM output
+struct ReadPairTruth {
+  std::string chrom;
+  int32_t start;
+  int32_t frag_seq_length;
+  bool first_is_forward;
+  int32_t offset_forward;
+  int32_t offset_reverse;
+  std::vector<CigarOp> cigar_forward;
+  std::vector<CigarOp> cigar_reverse;
+};
+
+// Reads sequenced from one genome copy, in the order they are written out
+struct SequencedReads {
+  int copy_index;
+  std::vector<std::string> reads_1;
+  std::vector<std::string> reads_2;
+  std::vector<std::string> ids;
+  std::vector<ReadPairTruth> truths; // only filled if asked for
+};
+
 class Sequencer {
  public:
-  Sequencer(const Options& options);
+  /* Fragments are fetched from packed_genome if given, else from the FASTA */
+  Sequencer(const Options& options, const PackedGenome* _packed_genome = NULL);
   virtual ~Sequencer();
 
-  void Sequence(const std::vector<Fragment>& input_fragments, const int& numreads,  \
-                    int& fastq_index, int thread_index, int copy_index, std::mt19937& rng);
+  void Sequence(const std::vector<Fragment>& input_fragments, const std::int64_t& numreads,
+		const bool& record_truth, SequencedReads* reads, SimRng& rng);
+
+  /* FASTQ records of mate 1 or 2 */
+  void FormatFastq(const SequencedReads& reads, const int& mate, std::string* records);
+
+  /* Alignments of all reads at their true positions */
+  void FormatBam(const SequencedReads& reads, const BamHeader* bam_header,
+		 std::vector<BamAlignment>* alignments);
+
+  /* Simulate a read from the start of frag, with sequencing errors */
+  bool Fragment2Read(const std::string frag, std::string& read, SimRng& rng,
+		     std::vector<CigarOp>* cigar_ops = NULL, int32_t* ref_offset = NULL);
+  std::string ReverseComplement(const std::string seq);
  private:
   RefGenome* ref_genome;
+  const PackedGenome* packed_genome;
   bool paired;
-  std::string outprefix;
   int readlen;
   std::string sequencer_type;
   float pcr_rate;
@@ -28,17 +65,23 @@ class Sequencer {
   float del_rate;
   float ins_rate;
 
+  // Fetch fragment sequences this many at a time, in coordinate order,
+  // merging fragments closer than FETCH_MERGE_GAP into one fetch of at
+  // most FETCH_MAX_WINDOW bases
+  static const size_t FETCH_BATCH_SIZE = 4096;
+  static const int32_t FETCH_MERGE_GAP = 1000;
+  static const int32_t FETCH_MAX_WINDOW = 1 << 20;
+
+  bool FetchSequence(const std::string& chrom, const int32_t& start, const int32_t& end, std::string* seq);
+  void FetchBatch(const std::vector<Fragment>& input_fragments, const std::vector<size_t>& frag_indices,
+		  const size_t& begin, const size_t& end, std::vector<std::string>* seqs,
+		  std::vector<bool>* fetched);
+
   static const std::map<char, char> NucleotideMap;
   static const char NucleotideTypesUpper[];
   static const char NucleotideTypesLower[];
   static const std::map<char, std::vector<char> > SubMap;
 
-  bool Fragment2Read(const std::string frag, std::string& read, std::mt19937& rng);
-  std::string ReverseComplement(const std::string seq);
-  bool save_into_fastq(const std::vector<std::string> reads,
-		       const std::vector<std::string> ids,
-		       const std::string ofilename,
-                        int& fastq_index, int copy_index);
   /*
   bool save_into_sam(const std::vector<std::string> reads1,
 		     const std::vector<std::string> reads2,
@@ -0,0 +1,83 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "common.h"
+#include "shard_files.h"
+
+const size_t MERGE_BLOCK_SIZE=1<<22; // bytes copied at a time when merging outputs
+
+/*
+ * Shards split the genome copies into contiguous ranges as evenly as
+ * possible. Shards get no copies when there are fewer copies than shards
+ * */
+void shard_copy_range(const int numcopies, const int shard_index, const int num_shards,
+		      int* copy_begin, int* copy_end){
+  *copy_begin = (int) ((int64_t) numcopies*shard_index/num_shards);
+  *copy_end = (int) ((int64_t) numcopies*(shard_index+1)/num_shards);
+}
+
+/*
+ * Output prefix of shard shard_index of num_shards
+ * */
+std::string shard_outprefix(const std::string& outprefix, const int shard_index, const int num_shards){
+  return outprefix + ".shard" + std::to_string(shard_index) + "of" + std::to_string(num_shards);
+}
+
+/*
+ * Append ifilename to ofilename, then remove ifilename
+ *
+ * If ofilename doesn't exist yet the file is simply renamed. Otherwise
+ * bytes are copied inside the kernel where possible (copy_file_range),
+ * falling back to large block reads and writes.
+ * */
+void merge_files(const std::string& ifilename, const std::string& ofilename,
+		 const bool kernel_copy){
+  if (access(ifilename.c_str(), F_OK) == -1) {
+    return; // this thread didn't write anything
+  }
+  if (access(ofilename.c_str(), F_OK) == -1 &&
+      std::rename(ifilename.c_str(), ofilename.c_str()) == 0) {
+    return;
+  }
+
+  int ifd = open(ifilename.c_str(), O_RDONLY);
+  int ofd = open(ofilename.c_str(), O_WRONLY | O_CREAT, 0644);
+  if (ifd == -1 || ofd == -1 || lseek(ofd, 0, SEEK_END) == -1) {
+    PrintMessageDieOnError("Failed to open " + ifilename + " and " + ofilename + " for merging", M_ERROR);
+  }
+  ssize_t nbytes = -1;
+#if defined(__linux__) && defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 27)
+  // Both file offsets advance, so a failure part way can be finished below
+  if (kernel_copy) {
+    while ((nbytes = copy_file_range(ifd, NULL, ofd, NULL, MERGE_BLOCK_SIZE, 0)) > 0) {}
+  }
+#endif
+#endif
+  if (nbytes != 0) {
+    std::vector<char> buffer(MERGE_BLOCK_SIZE);
+    while ((nbytes = read(ifd, &buffer[0], buffer.size())) > 0) {
+      ssize_t written = 0;
+      while (written < nbytes) {
+	ssize_t ret = write(ofd, &buffer[written], nbytes-written);
+	if (ret == -1 && errno != EINTR) {
+	  PrintMessageDieOnError("Failed to write to " + ofilename, M_ERROR);
+	}
+	if (ret > 0) written += ret;
+      }
+    }
+    if (nbytes == -1) {
+      PrintMessageDieOnError("Failed to read from " + ifilename, M_ERROR);
+    }
+  }
+  close(ifd);
+  if (close(ofd) == -1) {
+    PrintMessageDieOnError("Failed to write to " + ofilename, M_ERROR);
+  }
+  std::remove(ifilename.c_str());
+}
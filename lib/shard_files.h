@@ -0,0 +1,18 @@
+#ifndef SRC_SHARD_FILES_H__
+#define SRC_SHARD_FILES_H__
+
+#include <string>
+
+// Genome copies [copy_begin, copy_end) simulated by shard shard_index of num_shards
+void shard_copy_range(const int numcopies, const int shard_index, const int num_shards,
+		      int* copy_begin, int* copy_end);
+
+// Output prefix of shard shard_index of num_shards
+std::string shard_outprefix(const std::string& outprefix, const int shard_index, const int num_shards);
+
+// Append ifilename to ofilename, then remove ifilename. kernel_copy=false
+// skips copy_file_range and always copies with read and write
+void merge_files(const std::string& ifilename, const std::string& ofilename,
+		 const bool kernel_copy=true);
+
+#endif  // SRC_SHARD_FILES_H__
@@ -0,0 +1,70 @@
+#include "sim_rng.h"
+
+namespace {
+const uint32_t PhiloxM0 = 0xD2511F53;
+const uint32_t PhiloxM1 = 0xCD9E8D57;
+const uint32_t PhiloxW0 = 0x9E3779B9;
+const uint32_t PhiloxW1 = 0xBB67AE85;
+const int PhiloxRounds = 10;
+
+// Philox4x32 rounds on n blocks, one array per lane
+inline void PhiloxRounds4x32(uint32_t* c0, uint32_t* c1, uint32_t* c2, uint32_t* c3,
+			     const int n, const uint32_t key[2]) {
+  uint32_t k0 = key[0];
+  uint32_t k1 = key[1];
+  for (int round=0; round<PhiloxRounds; round++) {
+    for (int i=0; i<n; i++) {
+      uint64_t p0 = (uint64_t) PhiloxM0 * c0[i];
+      uint64_t p1 = (uint64_t) PhiloxM1 * c2[i];
+      uint32_t x0 = (uint32_t) (p1 >> 32) ^ c1[i] ^ k0;
+      uint32_t x2 = (uint32_t) (p0 >> 32) ^ c3[i] ^ k1;
+      c1[i] = (uint32_t) p1;
+      c3[i] = (uint32_t) p0;
+      c0[i] = x0;
+      c2[i] = x2;
+    }
+    k0 += PhiloxW0;
+    k1 += PhiloxW1;
+  }
+}
+}
+
+const uint32_t SimRng::SEQUENCE_STREAM;
+
+SimRng::SimRng(const uint32_t& seed, const uint32_t& copy, const uint32_t& _stream) {
+  key[0] = seed;
+  key[1] = copy;
+  stream = _stream;
+  next_block = 0;
+  buffer_pos = BUFFER_SIZE;
+}
+
+void SimRng::Block(const uint32_t counter[4], const uint32_t key[2], uint32_t output[4]) {
+  uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+  PhiloxRounds4x32(&c0, &c1, &c2, &c3, 1, key);
+  output[0] = c0;
+  output[1] = c1;
+  output[2] = c2;
+  output[3] = c3;
+}
+
+void SimRng::Refill() {
+  // Counter is (block number, stream, 0)
+  uint32_t c0[BLOCKS], c1[BLOCKS], c2[BLOCKS], c3[BLOCKS];
+  for (int i=0; i<BLOCKS; i++) {
+    uint64_t block = next_block + i;
+    c0[i] = (uint32_t) block;
+    c1[i] = (uint32_t) (block >> 32);
+    c2[i] = stream;
+    c3[i] = 0;
+  }
+  PhiloxRounds4x32(c0, c1, c2, c3, BLOCKS, key);
+  for (int i=0; i<BLOCKS; i++) {
+    buffer[4*i] = c0[i];
+    buffer[4*i+1] = c1[i];
+    buffer[4*i+2] = c2[i];
+    buffer[4*i+3] = c3[i];
+  }
+  next_block += BLOCKS;
+  buffer_pos = 0;
+}
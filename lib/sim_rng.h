@@ -0,0 +1,56 @@
+#ifndef SRC_SIM_RNG_H__
+#define SRC_SIM_RNG_H__
+
+#include <stdint.h>
+
+class SimRng {
+  /*
+    Counter-based random numbers (Philox4x32-10, Salmon et al. 2011).
+    Each output block is a pure function of (seed, copy) as the key and
+    (stream, block number) as the counter, so every bin of every copy has
+    its own stream that can be started on any thread without carrying
+    state over from the bins before it, and costs nothing to set up.
+
+    Blocks are made BLOCKS at a time with the lanes in separate arrays,
+    which the compiler turns into SIMD code. Meets the standard
+    UniformRandomBitGenerator requirements, so it works with the
+    std:: distributions and std::shuffle.
+   */
+ public:
+  typedef uint32_t result_type;
+
+  // Stream used for sequencing a copy; bins use their index
+  static const uint32_t SEQUENCE_STREAM = 0xffffffff;
+
+  SimRng(const uint32_t& seed=0, const uint32_t& copy=0, const uint32_t& stream=0);
+
+  static constexpr result_type min() {return 0;}
+  static constexpr result_type max() {return 0xffffffff;}
+
+  result_type operator()() {
+    if (buffer_pos == BUFFER_SIZE) Refill();
+    return buffer[buffer_pos++];
+  }
+
+  /* Uniform in [0, 1), from the top 24 bits of one output */
+  float Uniform() {
+    return (float) ((*this)() >> 8) * (1.0f/16777216.0f);
+  }
+
+  /* One Philox4x32-10 block, for checking against the reference outputs */
+  static void Block(const uint32_t counter[4], const uint32_t key[2], uint32_t output[4]);
+
+ private:
+  static const int BLOCKS = 16;
+  static const int BUFFER_SIZE = 4*BLOCKS;
+
+  uint32_t key[2];
+  uint32_t stream;
+  uint64_t next_block;
+  uint32_t buffer[BUFFER_SIZE];
+  int buffer_pos;
+
+  void Refill();
+};
+
+#endif  // SRC_SIM_RNG_H__
@@ -2,23 +2,41 @@
 #include <iostream>
 #include <fstream>
 #include <functional>
+#include <map>
 #include <stdlib.h>
 #include <vector>
 #include <stdio.h>
 #include <random>
 #include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "bingenerator.h"
+#include "checkpoint_journal.h"
 #include "common.h"
+#include "direct_sampler.h"
+#include "fastq_writer.h"
 #include "fragment.h"
+#include "fragment_lengths.h"
+#include "fragment_reservoir.h"
 #include "library_constructor.h"
 #include "model.h"
 #include "options.h"
+#include "packed_genome.h"
 #include "pulldown.h"
+#include "run_stats.h"
 #include "sequencer.h"
+#include "shard_files.h"
+#include "sim_rng.h"
 #include "stringops.h"
+#include "trace_recorder.h"
+#include "truth_bam_writer.h"
 #include "peak_intervals.h"
 #include "multithread.h"
+#include "n_run_index.h"
 #include "multithread.cpp"
 #include "chipsConfig.h"
 
@@ -29,11 +47,101 @@ const bool DEBUG_SIM=true;
 
 // Function declarations
 void simulate_reads_help(void);
-void merge_files(std::string ifilename, std::string ofilename);
-void consume(TaskQueue <int> & q, Options options, PeakIntervals* pintervals, 
-                const std::vector<int>& reads_per_copy, const vector<unsigned>& seeds_list, int thread_index);
-void fill_queue(const int numcopies, TaskQueue<int> & q);
-void GetReadsPerCopy(std::vector<int>* reads_per_copy, const Options& options, const unsigned seed);
+void write_manifest(const Options& options);
+std::string reads_filename(const Options& options, const int thread_index, const int mate);
+std::string bam_filename(const Options& options, const int thread_index);
+std::vector<std::string> writer_files(const Options& options, const int writer_index);
+std::string run_settings(int argc, char* argv[]);
+void merge_shards(const Options& options);
+void write_stats(RunStats* run_stats, const Options& options);
+
+/*
+ * A unit of work: a run of consecutive bins of one genome copy
+ * */
+struct SimTask {
+  int copy_index;
+  int chunk_index;
+  int bin_begin;
+  int bin_end;
+};
+
+/*
+ * Library fragments of one genome copy. Chunks are filled by whichever
+ * thread runs them; the thread finishing the last chunk sequences the copy.
+ * With --stream only a sample the size of the read budget is kept
+ * */
+struct CopyFragments {
+  std::vector<std::vector<Fragment> > chunks;
+  FragmentReservoir reservoir;
+  std::mutex reservoir_mutex;
+  std::atomic<int> chunks_remaining;
+};
+
+/*
+ * Genome copies move through simreads in stages, each with its own threads:
+ *   pulldown -> sequence -> format -> write
+ * Stages hand whole copies to the next one through bounded queues, so
+ * shearing, read generation and output overlap instead of alternating
+ * */
+struct CopyLibrary {
+  int copy_index;
+  std::vector<Fragment> fragments;
+  SimRng rng; // continues the copy's random stream when sequencing
+};
+
+struct FormattedCopy {
+  int copy_index;
+  std::int64_t num_reads;
+  std::string records_1;
+  std::string records_2;
+  std::vector<BamAlignment> alignments;
+};
+
+const int QUEUE_SLOTS_PER_THREAD=2; // copies waiting for each thread of the next stage
+
+/*
+ * Genome copies already written out. A copy is only queued once the copy
+ * a fixed window before it in the queueing order is written, so a writer
+ * waiting on a slow copy holds back at most that many in its reorder buffer
+ * */
+class WrittenCopies {
+ public:
+  explicit WrittenCopies(const int numcopies) : written(numcopies, false) {}
+  void MarkWritten(const int copy_index){
+    std::lock_guard<std::mutex> lock(mutex);
+    written[copy_index] = true;
+    cond.notify_all();
+  }
+  void WaitWritten(const int copy_index){
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait(lock, [&]{ return written[copy_index]; });
+  }
+
+ private:
+  std::vector<bool> written;
+  std::mutex mutex;
+  std::condition_variable cond;
+};
+
+void pulldown_stage(BoundedQueue<SimTask>& tasks, const Options& options, PeakIntervals* pintervals,
+		    const BinTable& bins, const FragmentLengths& frag_lengths, const NRunIndex* nrun_index,
+		    const DirectSampler* direct_sampler,
+		    std::vector<CopyFragments>& copy_fragments, const std::vector<std::int64_t>& reads_per_copy,
+		    const vector<unsigned>& seeds_list, BoundedQueue<CopyLibrary>& libraries, RunStats* run_stats,
+		    TraceRecorder* trace);
+void sequence_stage(BoundedQueue<CopyLibrary>& libraries, const Options& options,
+		    const std::vector<std::int64_t>& reads_per_copy, BoundedQueue<SequencedReads>& sequenced,
+		    const PackedGenome* packed_genome, RunStats* run_stats, TraceRecorder* trace);
+void format_stage(BoundedQueue<SequencedReads>& sequenced, const Options& options,
+		  const PackedGenome* packed_genome, const BamHeader* bam_header, const std::vector<int>& copy_writer,
+		  std::vector<AlignedPtr<BoundedQueue<FormattedCopy> > >& formatted, RunStats* run_stats, TraceRecorder* trace);
+void write_stage(BoundedQueue<FormattedCopy>& formatted, const std::vector<int>& copies,
+		 const Options& options, CheckpointJournal* journal, WrittenCopies* written, int writer_index,
+		 RunStats* run_stats, TraceRecorder* trace);
+void fill_queue(const std::vector<int>& copy_order, const std::vector<std::int64_t>& reads_per_copy,
+		const int numbins, const int chunks_per_copy, const int window, WrittenCopies* written,
+		std::vector<CopyFragments>& copy_fragments, BoundedQueue<SimTask> & q, TraceRecorder* trace);
+void GetReadsPerCopy(std::vector<std::int64_t>* reads_per_copy, const Options& options, const unsigned seed);
 
 int simulate_reads_main(int argc, char* argv[]) {
   bool showHelp = false;
@@ -82,7 +190,7 @@ int simulate_reads_main(int argc, char* argv[]) {
       }
     } else if (PARAMETER_CHECK("--numreads", 10, parameterLength)) {
       if ((i+1) < argc) {
-	options.numreads = atoi(argv[i+1]);
+	options.numreads = atoll(argv[i+1]);
 	i++;
       }
     } else if (PARAMETER_CHECK("--readlen", 9, parameterLength)) {
@@ -99,6 +207,11 @@ int simulate_reads_main(int argc, char* argv[]) {
 	model.SetFrag(options.gamma_k, options.gamma_theta);
 	i++;
       }
+    } else if (PARAMETER_CHECK("--frag-lens", 11, parameterLength)) {
+      if ((i+1) < argc) {
+	options.frag_lens_file = argv[i+1];
+	i++;
+      }
     } else if (PARAMETER_CHECK("--spot", 6, parameterLength)) {
       if ((i+1) < argc) {
 	options.ratio_s = atof(argv[i+1]);
@@ -136,6 +249,54 @@ int simulate_reads_main(int argc, char* argv[]) {
       }
     } else if (PARAMETER_CHECK("--paired", 8, parameterLength)) {
       options.paired = true;
+    } else if (PARAMETER_CHECK("--stream", 8, parameterLength)) {
+      options.stream_reads = true;
+    } else if (PARAMETER_CHECK("--packed-ref", 12, parameterLength)) {
+      options.packed_reference = true;
+    } else if (PARAMETER_CHECK("--gzip", 6, parameterLength)) {
+      options.gzip_output = true;
+    } else if (PARAMETER_CHECK("--bam", 5, parameterLength)) {
+      options.bam_output = true;
+    } else if (PARAMETER_CHECK("--compress-threads", 18, parameterLength)) {
+      if ((i+1) < argc) {
+	options.compress_threads = std::atoi(argv[i+1]);
+	i++;
+      }
+    } else if (PARAMETER_CHECK("--shard", 7, parameterLength)) {
+      if ((i+1) < argc) {
+	if (sscanf(argv[i+1], "%d/%d", &options.shard_index, &options.num_shards) != 2) {
+	  options.num_shards = 0; // reported below
+	}
+	i++;
+      }
+    } else if (PARAMETER_CHECK("--merge-shards", 14, parameterLength)) {
+      if ((i+1) < argc) {
+	options.merge_shards = std::atoi(argv[i+1]);
+	i++;
+      }
+    } else if (PARAMETER_CHECK("--resume", 8, parameterLength)) {
+      options.resume = true;
+    } else if (PARAMETER_CHECK("--stats-json", 12, parameterLength)) {
+      if ((i+1) < argc) {
+	options.stats_json = argv[i+1];
+	i++;
+      }
+    } else if (PARAMETER_CHECK("--trace", 7, parameterLength)) {
+      if ((i+1) < argc) {
+	options.trace_json = argv[i+1];
+	i++;
+      }
+    } else if (PARAMETER_CHECK("--keep-shards", 13, parameterLength)) {
+      options.keep_shards = true;
+    } else if (PARAMETER_CHECK("--exact-pulldown", 16, parameterLength)) {
+      options.exact_pulldown = true;
+    } else if (PARAMETER_CHECK("--keep-gaps", 11, parameterLength)) {
+      options.keep_gaps = true;
+    } else if (PARAMETER_CHECK("--engine", 8, parameterLength)) {
+      if ((i+1) < argc) {
+	options.engine = argv[i+1];
+	i++;
+      }
     } else if (PARAMETER_CHECK("-b", 2, parameterLength)) {
       if ((i+1) < argc) {
 	options.chipbam = argv[i+1];
@@ -160,6 +321,21 @@ int simulate_reads_main(int argc, char* argv[]) {
 	options.n_threads = std::atoi(argv[i+1]);
 	i++;
       }
+    } else if (PARAMETER_CHECK("--sequence-threads", 18, parameterLength)){
+      if ((i+1) < argc) {
+	options.sequence_threads = std::atoi(argv[i+1]);
+	i++;
+      }
+    } else if (PARAMETER_CHECK("--format-threads", 16, parameterLength)){
+      if ((i+1) < argc) {
+	options.format_threads = std::atoi(argv[i+1]);
+	i++;
+      }
+    } else if (PARAMETER_CHECK("--write-threads", 15, parameterLength)){
+      if ((i+1) < argc) {
+	options.write_threads = std::atoi(argv[i+1]);
+	i++;
+      }
     } else if (PARAMETER_CHECK("--sequencer", 11, parameterLength)){
       if ((i+1) < argc){
 	options.sequencer_type = argv[i+1];
@@ -213,27 +389,89 @@ int simulate_reads_main(int argc, char* argv[]) {
     cerr << "****** ERROR: Must specify peakfiletype with -t ******" << endl;
     showHelp = true;
   }
+  if (options.engine != "shear" && options.engine != "direct") {
+    cerr << "****** ERROR: --engine must be shear or direct ******" << endl;
+    showHelp = true;
+  }
+  if (options.sequence_threads <= 0) {
+    options.sequence_threads = options.n_threads;
+  }
+  if (options.n_threads < 1 || options.format_threads < 1 || options.write_threads < 1) {
+    cerr << "****** ERROR: Thread counts must be at least 1 ******" << endl;
+    showHelp = true;
+  }
+  if (options.num_shards < 1 || options.shard_index < 0 || options.shard_index >= options.num_shards) {
+    cerr << "****** ERROR: --shard must be i/N with 0 <= i < N ******" << endl;
+    showHelp = true;
+  }
+  if ((options.num_shards > 1 || options.merge_shards > 0) && options.keep_shards) {
+    cerr << "****** ERROR: --keep-shards can't be used with --shard or --merge-shards ******" << endl;
+    showHelp = true;
+  }
+  if (options.num_shards > 1 && options.seed == 0) {
+    cerr << "****** ERROR: --shard needs the same --seed for all shards ******" << endl;
+    showHelp = true;
+  }
+
+  // Time the stages of the run for --stats-json
+  RunStats* run_stats = NULL;
+  if (!options.stats_json.empty()) {
+    run_stats = new RunStats("simreads");
+  }
+
+  if (!showHelp && options.merge_shards > 0) {
+    StageTimer merge_timer;
+    merge_shards(options);
+    merge_timer.Stop();
+    if (run_stats != NULL) {
+      run_stats->AddThread("merge", merge_timer);
+      write_stats(run_stats, options);
+    }
+    PrintMessageDieOnError("Done!", M_PROGRESS);
+    return 0;
+  }
+  if (options.num_shards > 1) {
+    // A shard writes the usual outputs, under its own prefix
+    options.outprefix = shard_outprefix(options.outprefix, options.shard_index, options.num_shards);
+  }
 
   if (!showHelp) {
+    StageTimer setup_timer;
+
     // Print out parsed model
     PrintMessageDieOnError("Running simulate with the following model", M_PROGRESS);
     model.PrintModel();
 
-    // set up random seed
+    // Pick up an interrupted run with the same settings, or start over
+    CheckpointJournal journal(options.outprefix+".journal");
+    std::string settings = run_settings(argc, argv);
+    std::vector<std::vector<std::string> > files_per_writer;
+    for (int writer_index=0; writer_index<options.write_threads; writer_index++){
+      files_per_writer.push_back(writer_files(options, writer_index));
+    }
     unsigned rand_seed;
-    if (options.seed == 0){
-      rand_seed = std::chrono::system_clock::now().time_since_epoch().count();
-    }else{
-      rand_seed = options.seed;
+    bool resumed = options.resume && journal.Resume(settings, files_per_writer, &rand_seed);
+    if (resumed) {
+      if (options.seed != 0 && options.seed != rand_seed) {
+	PrintMessageDieOnError("--seed differs from the run being resumed", M_ERROR);
+      }
+      PrintMessageDieOnError("Resuming the run recorded in " + options.outprefix + ".journal", M_PROGRESS);
+    } else {
+      if (options.resume) {
+	PrintMessageDieOnError("Nothing to resume, starting a new run", M_WARNING);
+	options.resume = false;
+      }
+      // set up random seed
+      if (options.seed == 0){
+	rand_seed = std::chrono::system_clock::now().time_since_epoch().count();
+      }else{
+	rand_seed = options.seed;
+      }
     }
     std::cerr << "Current random seed: " << rand_seed << std::endl;
 
-    // Set up jobs
-    TaskQueue<int> task_queue;
-    fill_queue(options.numcopies, task_queue);
-
     // Determine number of reads per copy
-    std::vector<int> reads_per_copy;
+    std::vector<std::int64_t> reads_per_copy;
     GetReadsPerCopy(&reads_per_copy, options, rand_seed);
 
     // random seeds for individual threads
@@ -241,33 +479,35 @@ int simulate_reads_main(int argc, char* argv[]) {
     std::mt19937 rng_seed(rand_seed);
     for (int copy_index=0; copy_index<options.numcopies; copy_index++) seeds_list.push_back(rng_seed());
 
-    // Remove previous existing fastqs
-    if (options.paired){
-      // read - first pair
-      std::string reads1 = options.outprefix+"_1.fastq";
-      std::remove(reads1.c_str());
-      for (int thread_index=0; thread_index<options.n_threads; thread_index++){
-        reads1 = options.outprefix+"_"+std::to_string(thread_index)+"_1.fastq";
-        std::remove(reads1.c_str());
-      }
-      // read - second pair
-      std::string reads2 = options.outprefix+"_2.fastq";
-      std::remove(reads2.c_str());
-      for (int thread_index=0; thread_index<options.n_threads; thread_index++){
-        reads2 = options.outprefix+"_"+std::to_string(thread_index)+"_2.fastq";
-        std::remove(reads2.c_str());
-      }
+    // Remove previous existing outputs, unless we carry on with them
+    int nummates = options.paired ? 2 : 1;
+    std::string manifest = options.outprefix+".manifest";
+    std::remove(manifest.c_str());
+    for (int mate=1; mate<=nummates; mate++){
+      std::remove(reads_filename(options, -1, mate).c_str());
     }
-    else{
-      std::string reads = options.outprefix+".fastq";
-      std::remove(reads.c_str());
-      for (int thread_index=0; thread_index<options.n_threads; thread_index++){
-        reads = options.outprefix+"_"+std::to_string(thread_index)+".fastq";
-        std::remove(reads.c_str());
+    std::remove(bam_filename(options, -1).c_str());
+    if (!resumed) {
+      for (int writer_index=0; writer_index<options.write_threads; writer_index++){
+	for (size_t i=0; i<files_per_writer[writer_index].size(); i++){
+	  std::remove(files_per_writer[writer_index][i].c_str());
+	}
       }
+      journal.Start(rand_seed, settings);
     }
 
     /***************** Main implementation ***************/
+    // Tabulate fragment lengths once for all bins and copies
+    FragmentLengths frag_lengths(options);
+    if (!options.frag_lens_file.empty()) {
+      // Match the gamma to the histogram, for what only needs its mean and spread
+      stringstream ss;
+      ss << "Loaded fragment lengths from " << options.frag_lens_file << ", mean " << frag_lengths.Mean();
+      PrintMessageDieOnError(ss.str(), M_PROGRESS);
+      options.gamma_theta = (frag_lengths.Variance() > 0) ? frag_lengths.Variance()/frag_lengths.Mean() : 1;
+      options.gamma_k = frag_lengths.Mean()/options.gamma_theta;
+    }
+
     // Perform in bins so we don't keep everything in memory at once
     PrintMessageDieOnError("Loading the input ChIP-seq peak file (and BAM file if given)", M_PROGRESS);
     PeakIntervals* pintervals = \
@@ -288,40 +528,194 @@ int simulate_reads_main(int argc, char* argv[]) {
       model.PrintModel();
     }
 
-    // Create threads
+    // Find the runs of N (assembly gaps), which get no reads
+    NRunIndex* nrun_index = NULL;
+    if (!options.keep_gaps) {
+      PrintMessageDieOnError("Indexing runs of N in the reference", M_PROGRESS);
+      nrun_index = new NRunIndex(options.reffa, options.region.substr(0, options.region.find(':')));
+      PrintMessageDieOnError("Skipping " + std::to_string(nrun_index->TotalLength()) + " bases in runs of N",
+			     M_PROGRESS);
+    }
+
+    // Lay out the bins once, every copy is sheared over the same bins
+    BinTable bins(options, nrun_index);
+    if (bins.size() == 0) {
+      PrintMessageDieOnError("Nothing to simulate, the reference (or --region) is all N", M_ERROR);
+    }
+
+    // The direct engine samples each copy's fragments in one go
+    DirectSampler* direct_sampler = NULL;
+    if (options.engine == "direct") {
+      direct_sampler = new DirectSampler(options, bins, pintervals, frag_lengths, nrun_index);
+    }
+
+    // Set up jobs. Split each copy into chunks of bins so that
+    // all threads stay busy even when there are only a few copies
+    int chunks_per_copy = std::max(1, std::min((int) bins.size(), 4*options.n_threads));
+    if (direct_sampler != NULL) {
+      chunks_per_copy = 1;
+    }
+    std::vector<CopyFragments> copy_fragments(options.numcopies);
+
+    // A shard simulates a contiguous range of copies. Copies finished
+    // before the run was interrupted are skipped
+    int copy_begin, copy_end;
+    shard_copy_range(options.numcopies, options.shard_index, options.num_shards, &copy_begin, &copy_end);
+    std::vector<std::int64_t> pending_reads = reads_per_copy;
+    int copies_done = 0;
+    for (int copy_index=0; copy_index<options.numcopies; copy_index++){
+      if (copy_index < copy_begin || copy_index >= copy_end) {
+	pending_reads[copy_index] = 0;
+      } else if (journal.IsDone(copy_index)) {
+	pending_reads[copy_index] = 0;
+	copies_done++;
+      }
+    }
+    if (resumed) {
+      PrintMessageDieOnError("Skipping " + std::to_string(copies_done) + " finished genome copies", M_PROGRESS);
+    }
+
+    // Each writer gets a contiguous range of copies and writes them in order,
+    // so the merged output is the same for any number of threads (once
+    // decompressed with --gzip or --bam, as each writer makes its own BGZF
+    // blocks). Copies are queued round robin over the writers to keep all
+    // of them busy
+    std::vector<int> copy_writer(options.numcopies, -1);
+    std::vector<std::vector<int> > writer_copies(options.write_threads);
+    for (int copy_index=copy_begin; copy_index<copy_end; copy_index++){
+      copy_writer[copy_index] = (int) ((int64_t) (copy_index-copy_begin)*options.write_threads/(copy_end-copy_begin));
+      if (pending_reads[copy_index] > 0) {
+	writer_copies[copy_writer[copy_index]].push_back(copy_index);
+      }
+    }
+    std::vector<int> copy_order;
+    for (size_t i=0; copy_order.size()<(size_t) options.numcopies; i++){
+      bool any_left = false;
+      for (int writer_index=0; writer_index<options.write_threads; writer_index++){
+	if (i < writer_copies[writer_index].size()) {
+	  copy_order.push_back(writer_copies[writer_index][i]);
+	  any_left = true;
+	}
+      }
+      if (!any_left) break;
+    }
+
+    // Truth BAM records refer to the chromosomes of the FASTA index
+    BamHeader* bam_header = NULL;
+    if (options.bam_output) {
+      bam_header = TruthBamWriter::MakeHeader(options.reffa);
+    }
+
+    // Load the reference once for all sequencing threads
+    PackedGenome* packed_genome = NULL;
+    if (options.packed_reference) {
+      PrintMessageDieOnError("Loading the reference genome into memory", M_PROGRESS);
+      packed_genome = new PackedGenome(options.reffa);
+      PrintMessageDieOnError("Packed reference uses " + std::to_string(packed_genome->MemoryBytes()/(1<<20)) + " MB",
+			     M_PROGRESS);
+    }
+
+    setup_timer.Stop();
+    if (run_stats != NULL) {
+      run_stats->AddThread("setup", setup_timer);
+    }
+
+    // Record a timeline of the stage threads for --trace
+    TraceRecorder* trace = NULL;
+    if (!options.trace_json.empty()) {
+      trace = new TraceRecorder();
+    }
+
+    // Create threads for each stage
     PrintMessageDieOnError("Simulating reads based on the input profile", M_PROGRESS);
-    std::vector<std::thread> consumers;
+    BoundedQueue<SimTask> task_queue(QUEUE_SLOTS_PER_THREAD*chunks_per_copy*options.n_threads);
+    BoundedQueue<CopyLibrary> library_queue(QUEUE_SLOTS_PER_THREAD*options.sequence_threads);
+    BoundedQueue<SequencedReads> sequenced_queue(QUEUE_SLOTS_PER_THREAD*options.format_threads);
+    std::vector<AlignedPtr<BoundedQueue<FormattedCopy> > > formatted_queues;
+    for (int writer_index=0; writer_index<options.write_threads; writer_index++){
+      formatted_queues.push_back(MakeAligned<BoundedQueue<FormattedCopy> >(QUEUE_SLOTS_PER_THREAD));
+    }
+    // Copies in flight: enough to fill the queues and threads of every stage
+    int copy_window = QUEUE_SLOTS_PER_THREAD*(options.n_threads+options.sequence_threads+options.format_threads+
+					      options.write_threads);
+    WrittenCopies written_copies(options.numcopies);
+    std::vector<std::thread> pulldown_threads, sequence_threads, format_threads, write_threads;
     for (int thread_index=0; thread_index<options.n_threads; thread_index++){
-      std::thread cnsmr(std::bind(consume, std::ref(task_queue), options, pintervals, reads_per_copy, seeds_list, thread_index));
-      consumers.push_back(std::move(cnsmr));
+      pulldown_threads.push_back(std::thread(pulldown_stage, std::ref(task_queue), std::cref(options), pintervals,
+					     std::cref(bins), std::cref(frag_lengths), nrun_index, direct_sampler,
+					     std::ref(copy_fragments),
+					     std::cref(reads_per_copy), std::cref(seeds_list), std::ref(library_queue),
+					     run_stats, trace));
+    }
+    for (int thread_index=0; thread_index<options.sequence_threads; thread_index++){
+      sequence_threads.push_back(std::thread(sequence_stage, std::ref(library_queue), std::cref(options),
+					     std::cref(reads_per_copy), std::ref(sequenced_queue), packed_genome,
+					     run_stats, trace));
+    }
+    for (int thread_index=0; thread_index<options.format_threads; thread_index++){
+      format_threads.push_back(std::thread(format_stage, std::ref(sequenced_queue), std::cref(options),
+					   packed_genome, bam_header, std::cref(copy_writer), std::ref(formatted_queues), run_stats,
+					   trace));
+    }
+    for (int writer_index=0; writer_index<options.write_threads; writer_index++){
+      write_threads.push_back(std::thread(write_stage, std::ref(*formatted_queues[writer_index]),
+					  std::cref(writer_copies[writer_index]), std::cref(options),
+					  &journal, &written_copies, writer_index, run_stats, trace));
     }
 
-    // wait until all threads finish
-    for (auto & cnsmr: consumers){
-      cnsmr.join();
+    // Feed the first stage, then shut the pipeline down stage by stage
+    fill_queue(copy_order, pending_reads, bins.size(), chunks_per_copy, copy_window, &written_copies,
+	       copy_fragments, task_queue, trace);
+    task_queue.Close();
+    for (auto & thread: pulldown_threads) thread.join();
+    library_queue.Close();
+    for (auto & thread: sequence_threads) thread.join();
+    sequenced_queue.Close();
+    for (auto & thread: format_threads) thread.join();
+    for (auto & queue: formatted_queues) queue->Close();
+    for (auto & thread: write_threads) thread.join();
+    delete packed_genome;
+    if (trace != NULL) {
+      PrintMessageDieOnError("Writing timeline to " + options.trace_json, M_PROGRESS);
+      trace->WriteJson(options.trace_json);
+      delete trace;
     }
-   
- 
-    PrintMessageDieOnError("Writing reads into file", M_PROGRESS);
-    for (int thread_index=0; thread_index<options.n_threads; thread_index++){
-      if (options.paired){
-        std::string ifilename_1 = options.outprefix+"_"+std::to_string(thread_index)+"_1.fastq";
-        std::string ofilename_1 = options.outprefix+"_1.fastq";
-        merge_files(ifilename_1, ofilename_1);
-        std::remove(ifilename_1.c_str());
-
-        std::string ifilename_2 = options.outprefix+"_"+std::to_string(thread_index)+"_2.fastq";
-        std::string ofilename_2 = options.outprefix+"_2.fastq";
-        merge_files(ifilename_2, ofilename_2);
-        std::remove(ifilename_2.c_str());
-      }else{
-        std::string ifilename = options.outprefix+"_"+std::to_string(thread_index)+".fastq";
-        std::string ofilename = options.outprefix+".fastq";
-        merge_files(ifilename, ofilename);
-        std::remove(ifilename.c_str());
+
+    StageTimer merge_timer;
+    journal.StartMerge();
+    if (bam_header != NULL) {
+      // The per-writer BAMs have no header, so they are always merged.
+      // Shards leave out the header too, --merge-shards adds it
+      if (options.num_shards == 1) {
+	BamWriter header_writer(bam_filename(options, -1), bam_header);
+	header_writer.Close();
+      }
+      for (int writer_index=0; writer_index<options.write_threads; writer_index++){
+	merge_files(bam_filename(options, writer_index), bam_filename(options, -1));
+      }
+      delete bam_header;
+    }
+    if (options.keep_shards) {
+      PrintMessageDieOnError("Writing list of per-thread read files to " + manifest, M_PROGRESS);
+      write_manifest(options);
+    } else {
+      PrintMessageDieOnError("Writing reads into file", M_PROGRESS);
+      for (int writer_index=0; writer_index<options.write_threads; writer_index++){
+        for (int mate=1; mate<=nummates; mate++){
+          merge_files(reads_filename(options, writer_index, mate), reads_filename(options, -1, mate));
+        }
       }
     }
 
+    journal.Remove();
+    merge_timer.Stop();
+    if (run_stats != NULL) {
+      run_stats->AddThread("merge", merge_timer);
+      write_stats(run_stats, options);
+    }
+
+    delete direct_sampler;
+    delete nrun_index;
     delete pintervals;
     PrintMessageDieOnError("Done!", M_PROGRESS);
     return 0;
@@ -334,96 +728,449 @@ int simulate_reads_main(int argc, char* argv[]) {
 
 /*
  * Determine the number of reads per genome copy
+ *
+ * Each read goes to a copy uniformly at random, so the counts are
+ * multinomial. Draw them by sequential binomial splitting: copy i gets
+ * Binomial(reads left, 1/(copies left)) reads. This is O(numcopies)
+ * rather than O(numreads) and depends only on the seed.
  * */
-void GetReadsPerCopy(std::vector<int>* reads_per_copy, const Options& options, const unsigned seed) {
-  // Initialize vector
-  reads_per_copy->clear();
-  for (size_t i=0; i<options.numcopies; i++) {
-    reads_per_copy->push_back(0);
-  }
-  // Assign each read to a copy
-  //std::random_device rd;
+void GetReadsPerCopy(std::vector<std::int64_t>* reads_per_copy, const Options& options, const unsigned seed) {
+  reads_per_copy->assign(options.numcopies, 0);
   std::mt19937 rng(seed);
-  std::uniform_int_distribution<int> uni(0, options.numcopies-1);
-  int copynum;
-  for (size_t i=0; i<options.numreads; i++) {
-    copynum = uni(rng);
-    (*reads_per_copy)[copynum] += 1;
+  std::int64_t reads_left = options.numreads;
+  for (int copy_index=0; copy_index<options.numcopies; copy_index++) {
+    if (reads_left == 0) break;
+    if (copy_index == options.numcopies-1) {
+      (*reads_per_copy)[copy_index] = reads_left;
+      break;
+    }
+    std::binomial_distribution<std::int64_t> copydist(reads_left, 1.0/(options.numcopies-copy_index));
+    (*reads_per_copy)[copy_index] = copydist(rng);
+    reads_left -= (*reads_per_copy)[copy_index];
   }
 }
 
 /*
- * A thread that generates genome copies
+ * Split every genome copy that gets reads into chunks of bins
+ * Tasks are queued copy by copy (in copy_order). A copy waits until the copy
+ * window places before it has been written, so at most window copies are in flight
  * */
-void fill_queue(const int numcopies, TaskQueue<int> & q){
-  for (int copy_index=0; copy_index<numcopies; copy_index++){
-    q.push(copy_index);
+void fill_queue(const std::vector<int>& copy_order, const std::vector<std::int64_t>& reads_per_copy,
+		const int numbins, const int chunks_per_copy, const int window, WrittenCopies* written,
+		std::vector<CopyFragments>& copy_fragments, BoundedQueue<SimTask> & q, TraceRecorder* trace){
+  for (size_t order_index=0; order_index<copy_order.size(); order_index++){
+    int copy_index = copy_order[order_index];
+    if (reads_per_copy[copy_index] == 0) {
+      continue; // If we're not going to get any reads, don't bother simulating
+    }
+    if (order_index >= (size_t) window) {
+      written->WaitWritten(copy_order[order_index-window]);
+    }
+    copy_fragments[copy_index].chunks.resize(chunks_per_copy);
+    copy_fragments[copy_index].reservoir.SetCapacity(reads_per_copy[copy_index]);
+    copy_fragments[copy_index].chunks_remaining = chunks_per_copy;
+    if (trace != NULL) {
+      trace->BeginCopy(copy_index);
+    }
+    for (int chunk_index=0; chunk_index<chunks_per_copy; chunk_index++){
+      SimTask task;
+      task.copy_index = copy_index;
+      task.chunk_index = chunk_index;
+      task.bin_begin = (int) ((int64_t) numbins*chunk_index/chunks_per_copy);
+      task.bin_end = (int) ((int64_t) numbins*(chunk_index+1)/chunks_per_copy);
+      q.Push(task);
+    }
   }
 }
 
 
 /*
- * A thread that operate on a single genome copy
+ * Pulldown stage: shear chunks of bins. The thread finishing the last chunk
+ * of a genome copy passes the copy's library on to be sequenced
  * */
-void consume(TaskQueue <int> & q, Options options, PeakIntervals* pintervals,
-                    const std::vector<int>& reads_per_copy, const vector<unsigned>& seeds_list, int thread_index){
-  while (true){
-    int copy_index = -1;
-    try{
-      copy_index = q.pop();
-    } catch (std::out_of_range e){
-      //cerr << thread_index << endl;
-      break;
-    }
-
-    if ((copy_index > 0) && (copy_index%100 == 0)) {
-        int job_percentage = (int) (100 * copy_index / (float) options.numcopies);
-        PrintMessageDieOnError("Simulated " + std::to_string(job_percentage) +"% reads.", M_PROGRESS);
-    }
+void pulldown_stage(BoundedQueue<SimTask>& tasks, const Options& options, PeakIntervals* pintervals,
+		    const BinTable& bins, const FragmentLengths& frag_lengths, const NRunIndex* nrun_index,
+		    const DirectSampler* direct_sampler,
+		    std::vector<CopyFragments>& copy_fragments, const std::vector<std::int64_t>& reads_per_copy,
+		    const vector<unsigned>& seeds_list, BoundedQueue<CopyLibrary>& libraries, RunStats* run_stats,
+		    TraceRecorder* trace){
+  if (trace != NULL) {
+    trace->RegisterThread("pulldown");
+  }
+  StageTimer timer;
+  StatCounters& counters = ThreadStatCounters();
+  SimTask task;
+  while (tasks.Pop(task, &timer.idle_seconds)){
+    int copy_index = task.copy_index;
+    CopyLibrary library;
+    library.copy_index = copy_index;
 
-    if (reads_per_copy[copy_index] == 0) {
-      continue; // If we're not going to get any reads, don't bother simulating
+    if (direct_sampler != NULL) {
+      /*** Steps 1-3: Draw only the fragments that will be sequenced ***/
+      double direct_start = (trace != NULL) ? trace->Now() : 0;
+      library.rng = SimRng(seeds_list[copy_index], copy_index, SimRng::SEQUENCE_STREAM);
+      direct_sampler->Perform(&library.fragments, reads_per_copy[copy_index], library.rng);
+      counters.fragments_pulled_down += library.fragments.size();
+      counters.fragments_retained += library.fragments.size();
+      if (trace != NULL) {
+	trace->AddSpan("direct", direct_start, copy_index);
+      }
+      libraries.Push(library, &timer.idle_seconds);
+      continue;
     }
 
-    std::mt19937 rng(seeds_list[copy_index]);
-    int total_reads = 0;
-    int peakIndexStart = 0;
-    int start_offset = 0;
-    std::string prev_chrom = "";
-    BinGenerator bingenerator(options);
-    // set up. Clear pulldown each time. Append to lib_fragments and sequence at the end
-    vector <Fragment> pulldown_fragments, lib_fragments;
-    while (bingenerator.GotoNextBin()){
+    // set up. Clear pulldown each time. Append to this chunk's lib_fragments
+    // or, when streaming, to a sample no larger than the copy's read budget
+    vector <Fragment> pulldown_fragments;
+    vector <Fragment>& lib_fragments = copy_fragments[copy_index].chunks[task.chunk_index];
+    FragmentReservoir lib_reservoir(reads_per_copy[copy_index]);
+    for (int bin_index=task.bin_begin; bin_index<task.bin_end; bin_index++){
       if (options.verbose) {
 	stringstream ss;
-	ss << "Processing bin " << bingenerator.GetCurrentBinStr() << " " << copy_index;
+	ss << "Processing bin " << bins.GetBinStr(bins[bin_index]) << " " << copy_index;
 	PrintMessageDieOnError(ss.str(), M_PROGRESS);
       }
+      TraceSpan bin_span(trace, "bin", copy_index, bin_index);
+      // Each bin gets its own random stream so bins can run on any thread
+      SimRng rng(seeds_list[copy_index], copy_index, bin_index);
 
       /*** Step 1/2: Shearing + Pulldown ***/
-      Pulldown pulldown(options, bingenerator.GetCurrentBin(),\
-			prev_chrom, peakIndexStart, start_offset);
+      double pulldown_start = (trace != NULL) ? trace->Now() : 0;
+      Pulldown pulldown(options, bins, bin_index, frag_lengths, nrun_index);
       pulldown.Perform(&pulldown_fragments, pintervals, rng);
+      counters.fragments_pulled_down += pulldown_fragments.size();
+      if (trace != NULL) {
+	trace->AddSpan("pulldown", pulldown_start, copy_index, bin_index);
+      }
 
       /*** Step 3: Library construction NOTE PCR moved to sequencer ***/
+      TraceSpan library_span(trace, "library", copy_index, bin_index);
       LibraryConstructor lc(options);
-      lc.Perform(pulldown_fragments, &lib_fragments, rng);
+      if (options.stream_reads) {
+	lc.Perform(pulldown_fragments, &lib_reservoir, rng);
+      } else {
+	lc.Perform(pulldown_fragments, &lib_fragments, rng);
+      }
 
       /*** Cleanup for next bin ***/
       pulldown_fragments.clear();
     }
+    if (options.stream_reads) {
+      std::unique_lock<std::mutex> mlock(copy_fragments[copy_index].reservoir_mutex);
+      copy_fragments[copy_index].reservoir.Merge(lib_reservoir);
+    }
+
+    // Only the thread finishing the last chunk of a copy passes it on
+    if (--copy_fragments[copy_index].chunks_remaining > 0) {
+      continue;
+    }
+
+    // Gather chunks in bin order so the result doesn't depend on scheduling
+    double gather_start = (trace != NULL) ? trace->Now() : 0;
+    if (options.stream_reads) {
+      copy_fragments[copy_index].reservoir.GetFragments(&library.fragments);
+      copy_fragments[copy_index].reservoir.Clear();
+    }
+    std::vector<std::vector<Fragment> >& chunks = copy_fragments[copy_index].chunks;
+    for (size_t chunk_index=0; chunk_index<chunks.size(); chunk_index++){
+      library.fragments.insert(library.fragments.end(), chunks[chunk_index].begin(), chunks[chunk_index].end());
+      vector<Fragment>().swap(chunks[chunk_index]);
+    }
+    library.rng = SimRng(seeds_list[copy_index], copy_index, SimRng::SEQUENCE_STREAM);
+    counters.fragments_retained += library.fragments.size();
+    if (trace != NULL) {
+      trace->AddSpan("gather", gather_start, copy_index);
+    }
+    libraries.Push(library, &timer.idle_seconds);
+  }
+  timer.Stop();
+  if (run_stats != NULL) {
+    run_stats->AddThread("pulldown", timer);
+  }
+}
+
+/*
+ * Sequence stage: draw the reads of each finished genome copy
+ * */
+void sequence_stage(BoundedQueue<CopyLibrary>& libraries, const Options& options,
+		    const std::vector<std::int64_t>& reads_per_copy, BoundedQueue<SequencedReads>& sequenced,
+		    const PackedGenome* packed_genome, RunStats* run_stats, TraceRecorder* trace){
+  if (trace != NULL) {
+    trace->RegisterThread("sequence");
+  }
+  StageTimer timer;
+  Sequencer seq(options, packed_genome);
+  CopyLibrary library;
+  while (libraries.Pop(library, &timer.idle_seconds)){
     /*** Step 4: Sequencing ***/
-    Sequencer seq(options);
-    seq.Sequence(lib_fragments, reads_per_copy[copy_index], total_reads, thread_index, copy_index, rng);
+    double sequence_start = (trace != NULL) ? trace->Now() : 0;
+    SequencedReads reads;
+    reads.copy_index = library.copy_index;
+    seq.Sequence(library.fragments, reads_per_copy[library.copy_index], options.bam_output, &reads, library.rng);
+    if (trace != NULL) {
+      trace->AddSpan("sequence", sequence_start, library.copy_index);
+    }
+    vector<Fragment>().swap(library.fragments);
+    sequenced.Push(reads, &timer.idle_seconds);
+  }
+  timer.Stop();
+  if (run_stats != NULL) {
+    run_stats->AddThread("sequence", timer);
   }
 }
 
-void merge_files(std::string ifilename, std::string ofilename){
-  std::ifstream ifile(ifilename.c_str());
-  std::ofstream ofile(ofilename.c_str(), std::ofstream::app);
-  std::string line;
-  while (std::getline(ifile, line)){
-    ofile<<line<<"\n";
+/*
+ * Format stage: turn reads into FASTQ text and BAM records
+ * */
+void format_stage(BoundedQueue<SequencedReads>& sequenced, const Options& options,
+		  const PackedGenome* packed_genome, const BamHeader* bam_header, const std::vector<int>& copy_writer,
+		  std::vector<AlignedPtr<BoundedQueue<FormattedCopy> > >& formatted, RunStats* run_stats, TraceRecorder* trace){
+  if (trace != NULL) {
+    trace->RegisterThread("format");
+  }
+  StageTimer timer;
+  Sequencer seq(options, packed_genome);
+  SequencedReads reads;
+  while (sequenced.Pop(reads, &timer.idle_seconds)){
+    double format_start = (trace != NULL) ? trace->Now() : 0;
+    FormattedCopy copy;
+    copy.copy_index = reads.copy_index;
+    copy.num_reads = reads.reads_1.size();
+    seq.FormatFastq(reads, 1, &copy.records_1);
+    if (options.paired) {
+      seq.FormatFastq(reads, 2, &copy.records_2);
+    }
+    if (bam_header != NULL) {
+      seq.FormatBam(reads, bam_header, &copy.alignments);
+    }
+    if (trace != NULL) {
+      trace->AddSpan("format", format_start, copy.copy_index);
+    }
+    formatted[copy_writer[copy.copy_index]]->Push(copy, &timer.idle_seconds);
+  }
+  timer.Stop();
+  if (run_stats != NULL) {
+    run_stats->AddThread("format", timer);
+  }
+}
+
+/*
+ * Write stage: append this writer's copies to its read files in the order
+ * given by copies, then record them in the journal. Copies that arrive
+ * early wait in a reorder buffer, which fill_queue's window keeps small
+ * */
+void write_stage(BoundedQueue<FormattedCopy>& formatted, const std::vector<int>& copies,
+		 const Options& options, CheckpointJournal* journal, WrittenCopies* written, int writer_index,
+		 RunStats* run_stats, TraceRecorder* trace){
+  if (trace != NULL) {
+    trace->RegisterThread("write");
+  }
+  StageTimer timer;
+  StatCounters& counters = ThreadStatCounters();
+  // Each writer keeps its own read files open for the whole run
+  FastqWriter writer_1(reads_filename(options, writer_index, 1), options.gzip_output, options.compress_threads,
+		       options.resume);
+  FastqWriter* writer_2 = NULL;
+  if (options.paired) {
+    writer_2 = new FastqWriter(reads_filename(options, writer_index, 2), options.gzip_output, options.compress_threads,
+			       options.resume);
+  }
+  TruthBamWriter* truth_writer = NULL;
+  if (options.bam_output) {
+    truth_writer = new TruthBamWriter(bam_filename(options, writer_index), options.compress_threads, options.resume);
+  }
+  std::vector<std::int64_t> file_sizes;
+  std::int64_t bytes_before = 0; // resumed files already hold some copies
+  std::vector<std::string> files = writer_files(options, writer_index);
+  for (size_t i=0; i<files.size(); i++){
+    bytes_before += std::max((std::int64_t) 0, GetFileSize(files[i]));
+  }
+  std::map<int, FormattedCopy> reorder_buffer;
+  size_t next_copy = 0;
+  FormattedCopy arrived;
+  while (formatted.Pop(arrived, &timer.idle_seconds)){
+    reorder_buffer[arrived.copy_index] = std::move(arrived);
+    std::map<int, FormattedCopy>::iterator it;
+    while (next_copy < copies.size() &&
+	   (it = reorder_buffer.find(copies[next_copy])) != reorder_buffer.end()){
+      FormattedCopy& copy = it->second;
+      double write_start = (trace != NULL) ? trace->Now() : 0;
+      if ((copy.copy_index > 0) && (copy.copy_index%100 == 0)) {
+        int job_percentage = (int) (100 * copy.copy_index / (float) options.numcopies);
+        PrintMessageDieOnError("Simulated " + std::to_string(job_percentage) +"% reads.", M_PROGRESS);
+      }
+      writer_1.Write(copy.records_1);
+      if (writer_2 != NULL) {
+        writer_2->Write(copy.records_2);
+      }
+      if (truth_writer != NULL) {
+        truth_writer->Write(copy.alignments);
+      }
+
+      // The copy only counts as done once all of its reads reached the files
+      file_sizes.clear();
+      file_sizes.push_back(writer_1.Flush());
+      if (writer_2 != NULL) {
+        file_sizes.push_back(writer_2->Flush());
+      }
+      if (truth_writer != NULL) {
+        file_sizes.push_back(truth_writer->Flush());
+      }
+      journal->Record(copy.copy_index, writer_index, file_sizes);
+      written->MarkWritten(copy.copy_index);
+      std::int64_t bytes_after = 0;
+      for (size_t i=0; i<file_sizes.size(); i++){
+	bytes_after += file_sizes[i];
+      }
+      counters.reads_written += copy.num_reads;
+      counters.bytes_written += bytes_after-bytes_before;
+      bytes_before = bytes_after;
+      if (trace != NULL) {
+	trace->AddSpan("write", write_start, copy.copy_index);
+	trace->EndCopy(copy.copy_index);
+      }
+      reorder_buffer.erase(it);
+      next_copy++;
+    }
+  }
+  if (next_copy != copies.size()) {
+    PrintMessageDieOnError("Writer " + std::to_string(writer_index) + " is missing genome copies", M_ERROR);
+  }
+  writer_1.Close();
+  delete writer_2;
+  delete truth_writer;
+  timer.Stop();
+  if (run_stats != NULL) {
+    run_stats->AddThread("write", timer);
+  }
+}
+
+/*
+ * List the per-writer read files in outprefix.manifest, one line per
+ * writer thread. For paired reads each line has the _1 and _2 files, tab separated
+ * */
+void write_manifest(const Options& options){
+  std::ofstream manifest((options.outprefix+".manifest").c_str());
+  for (int writer_index=0; writer_index<options.write_threads; writer_index++){
+    if (access(reads_filename(options, writer_index, 1).c_str(), F_OK) == -1) continue;
+    manifest << reads_filename(options, writer_index, 1);
+    if (options.paired){
+      manifest << "\t" << reads_filename(options, writer_index, 2);
+    }
+    manifest << "\n";
+  }
+  manifest.close();
+  if (!manifest) {
+    PrintMessageDieOnError("Failed to write " + options.outprefix + ".manifest", M_ERROR);
+  }
+}
+
+/*
+ * Name of the reads file of a writer thread, or of the final output
+ * if thread_index is -1. mate (1 or 2) only matters for paired reads
+ * */
+std::string reads_filename(const Options& options, const int thread_index, const int mate){
+  std::string filename = options.outprefix;
+  if (thread_index >= 0) {
+    filename += "_" + std::to_string(thread_index);
+  }
+  if (options.paired) {
+    filename += "_" + std::to_string(mate);
+  }
+  filename += options.gzip_output ? ".fastq.gz" : ".fastq";
+  return filename;
+}
+
+/*
+ * Name of the truth BAM of a writer thread, or of the final output
+ * if thread_index is -1
+ * */
+std::string bam_filename(const Options& options, const int thread_index){
+  std::string filename = options.outprefix;
+  if (thread_index >= 0) {
+    filename += "_" + std::to_string(thread_index);
+  }
+  return filename + ".bam";
+}
+
+/*
+ * All files written by a writer thread, in the order the journal lists them
+ * */
+std::vector<std::string> writer_files(const Options& options, const int writer_index){
+  std::vector<std::string> files;
+  files.push_back(reads_filename(options, writer_index, 1));
+  if (options.paired) {
+    files.push_back(reads_filename(options, writer_index, 2));
+  }
+  if (options.bam_output) {
+    files.push_back(bam_filename(options, writer_index));
+  }
+  return files;
+}
+
+/*
+ * The command line minus --resume, --seed, --stats-json and --trace, to make sure
+ * a run is resumed with the same settings
+ * */
+std::string run_settings(int argc, char* argv[]){
+  std::string settings;
+  for (int i=1; i<argc; i++){
+    std::string arg = argv[i];
+    if (arg == "--resume") continue;
+    if (arg == "--seed" || arg == "--stats-json" || arg == "--trace") {
+      i++;
+      continue;
+    }
+    if (!settings.empty()) settings += " ";
+    settings += arg;
+  }
+  return settings;
+}
+
+/*
+ * Write the --stats-json report and free run_stats
+ * */
+void write_stats(RunStats* run_stats, const Options& options){
+  PrintMessageDieOnError("Writing run statistics to " + options.stats_json, M_PROGRESS);
+  run_stats->WriteJson(options.stats_json);
+  delete run_stats;
+}
+
+/*
+ * Concatenate the outputs of shards 0..N-1 into what a single run
+ * would have written. Shards hold contiguous ranges of genome copies,
+ * so this is just appending them in order
+ * */
+void merge_shards(const Options& options){
+  int nummates = options.paired ? 2 : 1;
+  std::vector<Options> shards(options.merge_shards, options);
+  for (int shard_index=0; shard_index<options.merge_shards; shard_index++){
+    shards[shard_index].outprefix = shard_outprefix(options.outprefix, shard_index, options.merge_shards);
+    for (int mate=1; mate<=nummates; mate++){
+      if (access(reads_filename(shards[shard_index], -1, mate).c_str(), F_OK) == -1) {
+	PrintMessageDieOnError("Missing shard output " + reads_filename(shards[shard_index], -1, mate), M_ERROR);
+      }
+    }
+    if (options.bam_output && access(bam_filename(shards[shard_index], -1).c_str(), F_OK) == -1) {
+      PrintMessageDieOnError("Missing shard output " + bam_filename(shards[shard_index], -1), M_ERROR);
+    }
+  }
+
+  PrintMessageDieOnError("Merging " + std::to_string(options.merge_shards) + " shards", M_PROGRESS);
+  for (int mate=1; mate<=nummates; mate++){
+    std::remove(reads_filename(options, -1, mate).c_str());
+    for (int shard_index=0; shard_index<options.merge_shards; shard_index++){
+      merge_files(reads_filename(shards[shard_index], -1, mate), reads_filename(options, -1, mate));
+    }
+  }
+  if (options.bam_output) {
+    BamHeader* bam_header = TruthBamWriter::MakeHeader(options.reffa);
+    BamWriter header_writer(bam_filename(options, -1), bam_header);
+    header_writer.Close();
+    delete bam_header;
+    for (int shard_index=0; shard_index<options.merge_shards; shard_index++){
+      merge_files(bam_filename(shards[shard_index], -1), bam_filename(options, -1));
+    }
   }
 }
 
@@ -436,7 +1183,7 @@ void simulate_reads_help(void) {
   cerr << "\n[Required arguments]: " << "\n";
   cerr << "     -p <peaks.bed>: BED file with peak regions" << "\n";
   cerr << "     -t <str>: The file format of your input peak file. Only `homer` or `bed` are supported. You can use -t wce with no BED file to simulate whole cell extract control data." << "\n";
-  cerr << "     -f <ref.fa>: FASTA file with reference genome" << "\n";
+  cerr << "     -f <ref.fa>: FASTA file with reference genome, or an image from chips index-ref" << "\n";
   cerr << "     -o <outprefix>: Prefix for output files" << "\n";
   cerr << "\n[Experiment parameters]: " << "\n";
   cerr << "     --numcopies <int>: Number of copies of the genome to simulate\n"
@@ -447,12 +1194,22 @@ void simulate_reads_help(void) {
        << "                        Default: " << options.readlen << "\n";
   cerr << "     --paired         : Simulate paired-end reads\n"
        << "                        Default: false \n";
+  cerr << "     --stream         : Keep only a random sample of fragments the size of each\n"
+       << "                        copy's read budget instead of every pulled down fragment.\n"
+       << "                        Lowers memory use for whole-genome runs\n"
+       << "                        Default: false \n";
+  cerr << "     --packed-ref     : Load the reference into memory once (2 bits per base) and\n"
+       << "                        fetch fragment sequences from there instead of the FASTA\n"
+       << "                        Default: false \n";
   cerr << "\n[Model parameters]: " << "\n";
   cerr << "     --model <str>               : JSON file with model parameters (e.g. from running learn\n";
   cerr << "                                   Setting parameters below overrides anything in the JSON file\n";
   cerr << "     --gamma-frag <float>,<float>: Parameters for fragment length distribution (alpha, beta).\n"
        << "                                   Default: " << options.gamma_k << ","
        << options.gamma_theta << "\n";
+  cerr << "     --frag-lens <file>          : Draw fragment lengths from the lengths in this file (one per\n"
+       << "                                   line, e.g. from learn --output-frag-lens) instead of the\n"
+       << "                                   gamma distribution\n";
   cerr << "     --spot <float>              : SPOT score (fraction of reads in peaks) \n"
        << "                                   Default: " << options.ratio_s << "\n";
   cerr << "     --frac <float>              : Fraction of the genome that is bound \n"
@@ -460,6 +1217,17 @@ void simulate_reads_help(void) {
   cerr << "     --recomputeF                : Recompute --frac param based on input peaks.\n";
   cerr << "     --pcr_rate <float>          : The rate of geometric distribution for PCR simulation\n"
        << "                                   Default: " << options.pcr_rate << "\n";
+  cerr << "     --engine <str>              : How fragments are generated. shear: shear and pull down\n"
+       << "                                   every copy of the genome. direct: draw only the fragments\n"
+       << "                                   that get sequenced. Much faster when each copy gets few\n"
+       << "                                   reads, e.g. with many copies.\n"
+       << "                                   Default: " << options.engine << "\n";
+  cerr << "     --exact-pulldown            : Score every fragment away from peaks instead of drawing\n"
+       << "                                   how many background fragments are thrown away before\n"
+       << "                                   the next kept one. Same output distribution, slower.\n"
+       << "                                   For validation only.\n";
+  cerr << "     --keep-gaps                 : Simulate reads from runs of N (assembly gaps) too, rather\n"
+       << "                                   than skipping them\n";
   cerr << "\n[Peak scoring: choose one]: " << "\n";
   cerr << "     -b <reads.bam>              : Read BAM file used to score each peak\n"
        << "                                 : Default: None (use the scores from the peak file)\n";
@@ -474,8 +1242,32 @@ void simulate_reads_help(void) {
        << "                                   Default: genome-wide \n";
   cerr << "     --binsize <int>             : Consider bins of this size when simulating\n"
        << "                                 : Default: " << options.binsize << "\n";
-  cerr << "     --thread <int>              : Number of threads used for computing\n"
+  cerr << "     --thread <int>              : Number of threads shearing genome copies\n"
        << "                                 : Default: " << options.n_threads << "\n";
+  cerr << "     --sequence-threads <int>    : Number of threads drawing reads from sheared copies\n"
+       << "                                 : Default: same as --thread\n";
+  cerr << "     --format-threads <int>      : Number of threads formatting reads for output\n"
+       << "                                 : Default: " << options.format_threads << "\n";
+  cerr << "     --write-threads <int>       : Number of threads writing reads, each to its own file\n"
+       << "                                 : Default: " << options.write_threads << "\n";
+  cerr << "     --gzip                      : Write BGZF compressed reads (.fastq.gz)\n";
+  cerr << "     --bam                       : Also write the reads at their true positions to outprefix.bam\n"
+       << "                                   (unsorted, no need to align the reads)\n";
+  cerr << "     --compress-threads <int>    : Number of threads compressing each output file with --gzip or --bam\n"
+       << "                                 : Default: " << options.compress_threads << "\n";
+  cerr << "     --shard <i/N>               : Only simulate the i-th of N equal parts of the genome copies\n"
+       << "                                   (0 <= i < N), writing to outprefix.shard<i>of<N>. Needs --seed\n";
+  cerr << "     --merge-shards <N>          : Combine the outputs of N shards run with otherwise the same\n"
+       << "                                   options into the output of a single run (the same once\n"
+       << "                                   decompressed, with --gzip or --bam)\n";
+  cerr << "     --resume                    : Carry on with an interrupted run (same options), skipping\n"
+       << "                                   the genome copies listed in outprefix.journal\n";
+  cerr << "     --keep-shards               : Don't merge the per-thread read files. List them\n"
+       << "                                   in outprefix.manifest instead\n";
+  cerr << "     --stats-json <file>         : Write wall and CPU time per stage and thread, counts of\n"
+       << "                                   fragments, reads and bytes, and peak memory to file\n";
+  cerr << "     --trace <file>              : Write a timeline of what each thread works on to file\n"
+       << "                                   (Chrome trace format, open in chrome://tracing or Perfetto)\n";
   cerr << "     --sequencer <std>           : Sequencing error values\n"
        << "                                 : Default: None (no sequencing errors)\n";
   cerr << "     --sub <float>               : Customized substitution value in sequecing\n";
@@ -0,0 +1,112 @@
+#include "trace_recorder.h"
+#include "common.h"
+
+#include <fstream>
+#include <iomanip>
+#include <unistd.h>
+
+namespace {
+// The calling thread's buffer. There is only ever one recorder per run
+thread_local void* current_buffer = NULL;
+}
+
+TraceRecorder::TraceRecorder() {
+  origin = std::chrono::steady_clock::now();
+}
+
+void TraceRecorder::RegisterThread(const std::string& name) {
+  std::unique_lock<std::mutex> mlock(buffers_mutex);
+  ThreadBuffer* buffer = new ThreadBuffer;
+  buffer->thread_name = name + " #" + std::to_string(threads_per_name[name]++);
+  buffers.push_back(std::unique_ptr<ThreadBuffer>(buffer));
+  current_buffer = buffer;
+}
+
+TraceRecorder::ThreadBuffer* TraceRecorder::GetThreadBuffer() {
+  if (current_buffer == NULL) {
+    RegisterThread("main");
+  }
+  return static_cast<ThreadBuffer*>(current_buffer);
+}
+
+double TraceRecorder::Now() const {
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin).count();
+}
+
+void TraceRecorder::AddSpan(const char* name, const double& start, const int& copy_index, const int& bin_index) {
+  TraceEvent event = {name, 'X', start, Now()-start, copy_index, bin_index};
+  GetThreadBuffer()->events.push_back(event);
+}
+
+void TraceRecorder::BeginCopy(const int& copy_index) {
+  TraceEvent event = {"copy", 'b', Now(), 0, copy_index, -1};
+  GetThreadBuffer()->events.push_back(event);
+}
+
+void TraceRecorder::EndCopy(const int& copy_index) {
+  TraceEvent event = {"copy", 'e', Now(), 0, copy_index, -1};
+  GetThreadBuffer()->events.push_back(event);
+}
+
+/*
+  Spans are complete ("X") events on the thread that ran them. A copy's
+  lifetime, from being queued to being written, is an async event with
+  the copy index as id, so Perfetto shows each copy on a track of its own
+*/
+void TraceRecorder::WriteJson(const std::string& filename) {
+  std::unique_lock<std::mutex> mlock(buffers_mutex);
+  std::ofstream trace(filename.c_str());
+  int pid = (int) getpid();
+  trace << std::fixed << std::setprecision(3);
+  trace << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  trace << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid
+	<< ",\"tid\":0,\"args\":{\"name\":\"chips simreads\"}}";
+  for (size_t tid=0; tid<buffers.size(); tid++) {
+    const ThreadBuffer& buffer = *buffers[tid];
+    trace << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << tid
+	  << ",\"args\":{\"name\":\"" << buffer.thread_name << "\"}}";
+    trace << ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << tid
+	  << ",\"args\":{\"sort_index\":" << tid << "}}";
+    for (size_t i=0; i<buffer.events.size(); i++) {
+      const TraceEvent& event = buffer.events[i];
+      trace << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"simreads\",\"ph\":\"" << event.phase
+	    << "\",\"pid\":" << pid << ",\"tid\":" << tid << ",\"ts\":" << event.start;
+      if (event.phase == 'X') {
+	trace << ",\"dur\":" << event.duration;
+      } else {
+	trace << ",\"id\":" << event.copy_index;
+      }
+      trace << ",\"args\":{";
+      if (event.copy_index >= 0) {
+	trace << "\"copy\":" << event.copy_index;
+      }
+      if (event.bin_index >= 0) {
+	trace << (event.copy_index >= 0 ? "," : "") << "\"bin\":" << event.bin_index;
+      }
+      trace << "}}";
+    }
+  }
+  trace << "\n]}\n";
+  trace.close();
+  if (!trace) {
+    PrintMessageDieOnError("Failed to write " + filename, M_ERROR);
+  }
+}
+
+TraceRecorder::~TraceRecorder() {
+  current_buffer = NULL;
+}
+
+TraceSpan::TraceSpan(TraceRecorder* _recorder, const char* _name, const int& _copy_index, const int& _bin_index) {
+  recorder = _recorder;
+  name = _name;
+  copy_index = _copy_index;
+  bin_index = _bin_index;
+  start = (recorder != NULL) ? recorder->Now() : 0;
+}
+
+TraceSpan::~TraceSpan() {
+  if (recorder != NULL) {
+    recorder->AddSpan(name, start, copy_index, bin_index);
+  }
+}
@@ -0,0 +1,78 @@
+#ifndef SRC_TRACE_RECORDER_H__
+#define SRC_TRACE_RECORDER_H__
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class TraceRecorder {
+  /*
+    Records a timeline of what each thread works on, written out in the
+    Chrome trace event format (load it in chrome://tracing or Perfetto).
+    Every thread appends to its own buffer, so recording a span doesn't
+    lock anything; the buffers are only gathered when writing the file.
+   */
+ public:
+  TraceRecorder();
+  virtual ~TraceRecorder();
+
+  /* Give the calling thread its own buffer, shown as name #<n> */
+  void RegisterThread(const std::string& name);
+
+  /* Microseconds since the recorder was created */
+  double Now() const;
+
+  /* A span of work on the calling thread from start to now.
+     copy_index and bin_index are shown when not negative */
+  void AddSpan(const char* name, const double& start, const int& copy_index=-1, const int& bin_index=-1);
+
+  /* Begin and end of the lifetime of a genome copy, which moves between threads */
+  void BeginCopy(const int& copy_index);
+  void EndCopy(const int& copy_index);
+
+  /* Write all events */
+  void WriteJson(const std::string& filename);
+
+ private:
+  struct TraceEvent {
+    const char* name;
+    char phase;   // X: span, b/e: begin/end of a copy
+    double start;
+    double duration;
+    int copy_index;
+    int bin_index;
+  };
+  struct ThreadBuffer {
+    std::string thread_name;
+    std::vector<TraceEvent> events;
+  };
+
+  std::chrono::steady_clock::time_point origin;
+  std::vector<std::unique_ptr<ThreadBuffer> > buffers;
+  std::map<std::string, int> threads_per_name;
+  std::mutex buffers_mutex;
+
+  ThreadBuffer* GetThreadBuffer();
+};
+
+class TraceSpan {
+  /*
+    Records a span from construction to destruction. Does nothing
+    if there is no recorder
+   */
+ public:
+  TraceSpan(TraceRecorder* _recorder, const char* _name, const int& _copy_index=-1, const int& _bin_index=-1);
+  ~TraceSpan();
+
+ private:
+  TraceRecorder* recorder;
+  const char* name;
+  int copy_index;
+  int bin_index;
+  double start;
+};
+
+#endif  // SRC_TRACE_RECORDER_H__
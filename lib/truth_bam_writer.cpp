@@ -0,0 +1,57 @@
+#include "truth_bam_writer.h"
+#include "common.h"
+#include "ref_genome.h"
+#include "htslib/hfile.h"
+
+TruthBamWriter::TruthBamWriter(const std::string& _filename, const int& compress_threads, const bool& append) {
+  filename = _filename;
+  output = bgzf_open(filename.c_str(), append ? "a" : "w");
+  if (output == NULL) {
+    PrintMessageDieOnError("Failed to open " + filename, M_ERROR);
+  }
+  if (compress_threads > 1 && bgzf_mt(output, compress_threads, 256) != 0) {
+    PrintMessageDieOnError("Failed to set up compression threads for " + filename, M_ERROR);
+  }
+}
+
+BamHeader* TruthBamWriter::MakeHeader(const std::string& reffa) {
+  RefGenome ref_genome(reffa);
+  std::vector<std::string> chroms;
+  std::map<std::string, int> chrom_lengths;
+  if (!ref_genome.GetChroms(&chroms) || !ref_genome.GetLengths(&chrom_lengths)) {
+    PrintMessageDieOnError("Error getting chromosomes of " + reffa, M_ERROR);
+  }
+  std::vector<uint32_t> lengths;
+  for (size_t i=0; i<chroms.size(); i++) {
+    lengths.push_back(chrom_lengths[chroms[i]]);
+  }
+  return make_bam_header(chroms, lengths);
+}
+
+void TruthBamWriter::Write(std::vector<BamAlignment>& alignments) {
+  for (size_t i=0; i<alignments.size(); i++) {
+    if (bam_write1(output, alignments[i].b_) < 0) {
+      PrintMessageDieOnError("Failed to write to " + filename, M_ERROR);
+    }
+  }
+}
+
+std::int64_t TruthBamWriter::Flush() {
+  if (bgzf_flush(output) != 0 || hflush(output->fp) != 0) {
+    PrintMessageDieOnError("Failed to write to " + filename, M_ERROR);
+  }
+  return GetFileSize(filename);
+}
+
+void TruthBamWriter::Close() {
+  if (output != NULL) {
+    if (bgzf_close(output) != 0) {
+      PrintMessageDieOnError("Failed to close " + filename, M_ERROR);
+    }
+    output = NULL;
+  }
+}
+
+TruthBamWriter::~TruthBamWriter() {
+  Close();
+}
@@ -0,0 +1,39 @@
+#ifndef SRC_TRUTH_BAM_WRITER_H__
+#define SRC_TRUTH_BAM_WRITER_H__
+
+#include "bam_io.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class TruthBamWriter {
+  /*
+    This class writes the simulated reads of one writer thread at their true
+    positions as (unsorted) BAM records. The files have no header: the final
+    BAM starts with just the header (see MakeHeader) and the per-writer files
+    are appended to it, which is fine since BGZF files can be concatenated.
+    BGZF blocks are compressed by compress_threads threads in the background.
+   */
+ public:
+  TruthBamWriter(const std::string& _filename, const int& compress_threads, const bool& append = false);
+  virtual ~TruthBamWriter();
+
+  /* Header listing the chromosomes of the reference FASTA index */
+  static BamHeader* MakeHeader(const std::string& reffa);
+
+  /* Append a batch of alignments */
+  void Write(std::vector<BamAlignment>& alignments);
+
+  /* Hand everything written so far to the OS, return the file size */
+  std::int64_t Flush();
+
+  /* Flush and close the file */
+  void Close();
+
+ private:
+  std::string filename;
+  BGZF* output;
+};
+
+#endif  // SRC_TRUTH_BAM_WRITER_H__
@@ -0,0 +1,313 @@
+#!/usr/bin/env python3
+"""
+Offline end-to-end benchmark for chips.
+
+Generates synthetic genomes (FASTA plus .fai) and peak BED files of a
+given size and peak density, runs `chips simreads` (and `chips learn`
+if samtools is available to sort and index the simulated reads) over a
+grid of genome sizes and thread counts, and records throughput and
+peak memory from the --stats-json reports. Results can be saved as a
+baseline and later runs compared against it. Needs nothing but Python 3
+and a chips binary, and no network access.
+
+Examples:
+  # Quick scaling curve, compared against an earlier run on this machine
+  ./chips-benchmark.py run --chips ../build/chips --baseline baseline.json
+  # Full curve, 1 Mb to 3 Gb and 1 to 64 threads, saved as the new baseline
+  ./chips-benchmark.py run --preset full --save-baseline baseline.json
+  # Only write a synthetic genome and peaks
+  ./chips-benchmark.py generate --size 100M --outdir bench-data
+"""
+
+import argparse
+import json
+import os
+import random
+import shutil
+import subprocess
+import sys
+import time
+
+LINE_WIDTH = 60
+MAX_CHROM_LENGTH = 250000000  # split larger genomes into chromosomes like human chr1
+BLOCK_LINES = 100000          # FASTA lines generated at a time
+
+PRESETS = {
+    "small": {"sizes": "1M,10M", "threads": "1,2,4"},
+    "medium": {"sizes": "1M,10M,100M", "threads": "1,4,16"},
+    "full": {"sizes": "1M,10M,100M,1G,3G", "threads": "1,4,16,64"},
+}
+
+# Metrics compared against the baseline, and whether higher is better
+METRICS = {
+    "reads_per_second": True,
+    "wall_seconds": False,
+    "peak_rss_kb": False,
+}
+
+
+def log(msg):
+    sys.stderr.write("[chips-benchmark]: %s\n" % msg)
+
+
+def parse_size(size):
+    """ Parse sizes such as 500k, 10M or 3G (bases) """
+    units = {"k": 10**3, "m": 10**6, "g": 10**9}
+    size = size.strip()
+    if size[-1].lower() in units:
+        return int(float(size[:-1]) * units[size[-1].lower()])
+    return int(size)
+
+
+def random_bytes(rng, n):
+    if hasattr(rng, "randbytes"):
+        return rng.randbytes(n)
+    return rng.getrandbits(8 * n).to_bytes(n, "little")
+
+
+def generate(genome_size, peaks_per_mb, peak_width, seed, outdir):
+    """
+    Write outdir/genome.fa(.fai) and outdir/peaks.bed. Each chromosome
+    starts with a 10 kb run of N, like real telomeres. Peaks are placed
+    uniformly at random with widths around peak_width and scores 1-100.
+    Files already there from an earlier call with the same arguments are reused
+    """
+    os.makedirs(outdir, exist_ok=True)
+    reffa = os.path.join(outdir, "genome.fa")
+    peaksbed = os.path.join(outdir, "peaks.bed")
+    settings = os.path.join(outdir, "settings.json")
+    wanted = {"genome_size": genome_size, "peaks_per_mb": peaks_per_mb,
+              "peak_width": peak_width, "seed": seed}
+    if os.path.exists(settings) and os.path.exists(peaksbed) and os.path.exists(reffa + ".fai"):
+        with open(settings) as f:
+            if json.load(f) == wanted:
+                return reffa, peaksbed
+
+    log("Generating a %d bp genome in %s" % (genome_size, outdir))
+    rng = random.Random(seed)
+    num_chroms = max(1, -(-genome_size // MAX_CHROM_LENGTH))
+    chrom_lengths = [genome_size // num_chroms] * num_chroms
+    chrom_lengths[-1] += genome_size - sum(chrom_lengths)
+    to_bases = bytes.maketrans(bytes(range(256)), b"ACGT" * 64)
+    offset = 0
+    with open(reffa, "wb") as fasta, open(reffa + ".fai", "w") as fai:
+        for chrom_index, chrom_length in enumerate(chrom_lengths):
+            chrom = "chr%d" % (chrom_index + 1)
+            header = (">%s\n" % chrom).encode()
+            fasta.write(header)
+            offset += len(header)
+            fai.write("%s\t%d\t%d\t%d\t%d\n" % (chrom, chrom_length, offset, LINE_WIDTH, LINE_WIDTH + 1))
+            n_run = min(10000, chrom_length)
+            written = 0
+            while written < chrom_length:
+                block_length = min(BLOCK_LINES * LINE_WIDTH, chrom_length - written)
+                block = bytearray(random_bytes(rng, block_length).translate(to_bases))
+                if written < n_run:
+                    block[:n_run - written] = b"N" * (n_run - written)
+                lines = [block[i:i + LINE_WIDTH] for i in range(0, block_length, LINE_WIDTH)]
+                fasta.write(b"\n".join(lines) + b"\n")
+                offset += block_length + len(lines)
+                written += block_length
+
+    with open(peaksbed, "w") as bed:
+        for chrom_index, chrom_length in enumerate(chrom_lengths):
+            chrom = "chr%d" % (chrom_index + 1)
+            num_peaks = int(peaks_per_mb * chrom_length / 1e6)
+            starts = sorted(rng.randrange(10000, max(10001, chrom_length - 2 * peak_width))
+                            for _ in range(num_peaks))
+            for start in starts:
+                width = max(50, int(rng.gauss(peak_width, peak_width / 4)))
+                end = min(chrom_length, start + width)
+                bed.write("%s\t%d\t%d\t%d\n" % (chrom, start, end, rng.randint(1, 100)))
+
+    with open(settings, "w") as f:
+        json.dump(wanted, f)
+    return reffa, peaksbed
+
+
+def run_chips(cmd):
+    """ Run a chips command and return its --stats-json report """
+    log(" ".join(cmd))
+    stats_json = cmd[cmd.index("--stats-json") + 1]
+    with open(stats_json + ".log", "w") as logfile:
+        ret = subprocess.call(cmd, stderr=logfile, stdout=logfile)
+    if ret != 0:
+        log("Failed, see %s.log" % stats_json)
+        return None
+    with open(stats_json) as f:
+        return json.load(f)
+
+
+def summarize(report, numreads):
+    result = {
+        "wall_seconds": report["wall_seconds"],
+        "cpu_seconds": report.get("cpu_seconds"),
+        "peak_rss_kb": report.get("peak_rss_kb"),
+        "stages": {stage["name"]: stage["wall_seconds"] for stage in report["stages"]},
+    }
+    if numreads:
+        result["reads_per_second"] = numreads / max(report["wall_seconds"], 1e-9)
+    return result
+
+
+def run(args):
+    if args.preset:
+        args.sizes = args.sizes or PRESETS[args.preset]["sizes"]
+        args.threads = args.threads or PRESETS[args.preset]["threads"]
+    sizes = [parse_size(size) for size in (args.sizes or PRESETS["small"]["sizes"]).split(",")]
+    threads = [int(t) for t in (args.threads or PRESETS["small"]["threads"]).split(",")]
+    samtools = shutil.which("samtools")
+    if not args.skip_learn and samtools is None:
+        log("samtools not found, skipping learn")
+    os.makedirs(args.workdir, exist_ok=True)
+
+    results = []
+    for genome_size in sizes:
+        datadir = os.path.join(args.workdir, "genome_%d" % genome_size)
+        reffa, peaksbed = generate(genome_size, args.peaks_per_mb, args.peak_width, args.seed, datadir)
+        numreads = max(1000, int(args.reads_per_mb * genome_size / 1e6))
+        for nthreads in threads:
+            rundir = os.path.join(args.workdir, "run_%d_%dt" % (genome_size, nthreads))
+            os.makedirs(rundir, exist_ok=True)
+            outprefix = os.path.join(rundir, "sim")
+            cmd = [args.chips, "simreads", "-p", peaksbed, "-t", "bed", "-c", "4", "-f", reffa,
+                   "-o", outprefix, "--numcopies", str(args.numcopies), "--numreads", str(numreads),
+                   "--seed", str(args.seed), "--thread", str(nthreads), "--paired",
+                   "--stats-json", outprefix + ".stats.json"]
+            report = run_chips(cmd + args.simreads_args.split())
+            if report is not None:
+                result = summarize(report, numreads)
+                result.update({"program": "simreads", "genome_size": genome_size, "threads": nthreads,
+                               "numreads": numreads})
+                results.append(result)
+            if not args.keep_outputs:
+                clean_outputs(rundir)
+
+        # learn is single threaded, run it once per genome size on simulated
+        # reads at their true positions (the run making them isn't timed)
+        if args.skip_learn or samtools is None:
+            continue
+        rundir = os.path.join(args.workdir, "run_%d_learn" % genome_size)
+        os.makedirs(rundir, exist_ok=True)
+        outprefix = os.path.join(rundir, "sim")
+        report = run_chips([args.chips, "simreads", "-p", peaksbed, "-t", "bed", "-c", "4", "-f", reffa,
+                            "-o", outprefix, "--numcopies", str(args.numcopies), "--numreads", str(numreads),
+                            "--seed", str(args.seed), "--thread", str(max(threads)), "--paired", "--bam",
+                            "--stats-json", outprefix + ".stats.json"])
+        sortedbam = outprefix + ".sorted.bam"
+        if report is not None and \
+           subprocess.call([samtools, "sort", "-o", sortedbam, outprefix + ".bam"]) == 0 and \
+           subprocess.call([samtools, "index", sortedbam]) == 0:
+            report = run_chips([args.chips, "learn", "-b", sortedbam, "-p", peaksbed, "-t", "bed",
+                                "-c", "4", "--paired", "-o", os.path.join(rundir, "learn"),
+                                "--stats-json", os.path.join(rundir, "learn.stats.json")])
+            if report is not None:
+                result = summarize(report, numreads)
+                result.update({"program": "learn", "genome_size": genome_size, "threads": 1,
+                               "numreads": numreads})
+                results.append(result)
+        if not args.keep_outputs:
+            clean_outputs(rundir)
+
+    print_results(results)
+    output = {"time": time.strftime("%Y-%m-%d %H:%M:%S"), "host": os.uname().nodename,
+              "cpus": os.cpu_count(), "results": results}
+    with open(os.path.join(args.workdir, "results.json"), "w") as f:
+        json.dump(output, f, indent=4)
+    if args.save_baseline:
+        with open(args.save_baseline, "w") as f:
+            json.dump(output, f, indent=4)
+        log("Saved baseline to %s" % args.save_baseline)
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        if compare(results, baseline["results"], args.tolerance) > 0:
+            return 1
+    return 0
+
+
+def clean_outputs(rundir):
+    """ Remove simulated reads, keeping the reports and logs """
+    for filename in os.listdir(rundir):
+        if not filename.endswith(".json") and not filename.endswith(".log"):
+            os.remove(os.path.join(rundir, filename))
+
+
+def print_results(results):
+    print("program\tgenome_size\tthreads\twall_seconds\tcpu_seconds\tpeak_rss_kb\treads_per_second")
+    for result in results:
+        print("%s\t%d\t%d\t%.2f\t%.2f\t%d\t%.0f" % (
+            result["program"], result["genome_size"], result["threads"], result["wall_seconds"],
+            result["cpu_seconds"] or 0, result["peak_rss_kb"] or 0, result.get("reads_per_second", 0)))
+
+
+def compare(results, baseline, tolerance):
+    """ Print changes against the baseline, return the number of regressions """
+    baseline_runs = {(b["program"], b["genome_size"], b["threads"]): b for b in baseline}
+    regressions = 0
+    print("\nprogram\tgenome_size\tthreads\tmetric\tbaseline\tcurrent\tchange")
+    for result in results:
+        key = (result["program"], result["genome_size"], result["threads"])
+        if key not in baseline_runs:
+            continue
+        for metric, higher_is_better in METRICS.items():
+            old = baseline_runs[key].get(metric)
+            new = result.get(metric)
+            if not old or new is None:
+                continue
+            change = (new - old) / old
+            worse = -change if higher_is_better else change
+            flag = ""
+            if worse > tolerance:
+                flag = "\tREGRESSION"
+                regressions += 1
+            print("%s\t%d\t%d\t%s\t%.4g\t%.4g\t%+.1f%%%s" % (key + (metric, old, new, 100 * change, flag)))
+    log("%d regressions beyond %.0f%%" % (regressions, 100 * tolerance))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    subparsers = parser.add_subparsers(dest="command")
+
+    gen = subparsers.add_parser("generate", help="Write a synthetic genome and peaks")
+    gen.add_argument("--size", default="10M", help="Genome size, e.g. 1M or 3G. Default: 10M")
+    gen.add_argument("--outdir", required=True, help="Output directory")
+
+    bench = subparsers.add_parser("run", help="Run the benchmark grid")
+    bench.add_argument("--chips", default="chips", help="chips binary. Default: chips on the PATH")
+    bench.add_argument("--workdir", default="chips-benchmark", help="Where inputs and outputs go. Default: chips-benchmark")
+    bench.add_argument("--preset", choices=sorted(PRESETS.keys()),
+                       help="Grid of sizes and threads: " +
+                       ", ".join("%s (%s; %s threads)" % (name, p["sizes"], p["threads"])
+                                 for name, p in sorted(PRESETS.items())) + ". Default: small")
+    bench.add_argument("--sizes", help="Comma separated genome sizes, overrides --preset")
+    bench.add_argument("--threads", help="Comma separated thread counts, overrides --preset")
+    bench.add_argument("--reads-per-mb", type=float, default=10000, help="Read pairs per Mb of genome. Default: 10000")
+    bench.add_argument("--numcopies", type=int, default=10, help="simreads --numcopies. Default: 10")
+    bench.add_argument("--simreads-args", default="", help="Extra simreads options, e.g. \"--gzip --stream\"")
+    bench.add_argument("--skip-learn", action="store_true", help="Only benchmark simreads")
+    bench.add_argument("--keep-outputs", action="store_true", help="Keep simulated reads")
+    bench.add_argument("--baseline", help="Compare against this results file, exit 1 on regressions")
+    bench.add_argument("--save-baseline", help="Save the results to this file")
+    bench.add_argument("--tolerance", type=float, default=0.1,
+                       help="Relative change counted as a regression. Default: 0.1")
+
+    for sub in (gen, bench):
+        sub.add_argument("--peaks-per-mb", type=float, default=50, help="Peak density. Default: 50")
+        sub.add_argument("--peak-width", type=int, default=500, help="Mean peak width. Default: 500")
+        sub.add_argument("--seed", type=int, default=1, help="Random seed. Default: 1")
+
+    args = parser.parse_args()
+    if args.command == "generate":
+        reffa, peaksbed = generate(parse_size(args.size), args.peaks_per_mb, args.peak_width, args.seed, args.outdir)
+        log("Wrote %s and %s" % (reffa, peaksbed))
+        return 0
+    if args.command == "run":
+        return run(args)
+    parser.print_help()
+    return 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
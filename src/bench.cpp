@@ -0,0 +1,333 @@
+/*
+  chips-bench: microbenchmarks for the kernels simreads spends its time in.
+
+  Builds a synthetic genome (FASTA and .fai) and peak BED in a temporary
+  directory, then times each kernel for a while and prints, per kernel,
+  the time and the number of heap allocations per unit of work (a base,
+  a fragment, a query or a read).
+*/
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "lib/bingenerator.h"
+#include "lib/common.h"
+#include "lib/fragment.h"
+#include "lib/fragment_lengths.h"
+#include "lib/options.h"
+#include "lib/packed_genome.h"
+#include "lib/peak_intervals.h"
+#include "lib/pulldown.h"
+#include "lib/ref_genome.h"
+#include "lib/sequencer.h"
+#include "lib/sim_rng.h"
+#include "chipsConfig.h"
+
+using namespace std;
+
+// define our parameter checking macro
+#define PARAMETER_CHECK(param, paramLen, actualLen) (strncmp(argv[i], param, min(actualLen, paramLen))== 0) && (actualLen == paramLen)
+
+/*
+  Count heap allocations made through operator new
+*/
+static std::atomic<std::int64_t> num_allocations(0);
+
+void* operator new(std::size_t size) {
+  num_allocations.fetch_add(1, std::memory_order_relaxed);
+  void* ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == NULL) throw std::bad_alloc();
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+struct BenchOptions {
+  int num_chroms = 2;
+  int chrom_length = 2000000;
+  int peak_spacing = 10000;
+  double min_seconds = 0.5;
+  unsigned seed = 1;
+  std::string workdir = "";
+};
+
+struct BenchResult {
+  std::string name;
+  std::string unit;
+  std::int64_t units;
+  double ns_per_unit;
+  double allocs_per_unit;
+};
+
+void bench_help(void);
+
+/*
+  Call op (which returns the units of work it did) until min_seconds
+  have passed, after one untimed warm-up call
+*/
+template <typename Op>
+BenchResult run_bench(const std::string& name, const std::string& unit, const double min_seconds, Op op) {
+  op();
+  std::int64_t units = 0;
+  std::int64_t allocs_before = num_allocations.load();
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  double elapsed = 0;
+  while (elapsed < min_seconds) {
+    units += op();
+    elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+  BenchResult result;
+  result.name = name;
+  result.unit = unit;
+  result.units = units;
+  result.ns_per_unit = elapsed*1e9/std::max((std::int64_t) 1, units);
+  result.allocs_per_unit = (num_allocations.load() - allocs_before)/(double) std::max((std::int64_t) 1, units);
+  return result;
+}
+
+/*
+  Write a random genome with a short N run at the start of each
+  chromosome, its .fai index, and evenly spaced peaks with random scores
+*/
+void make_inputs(const BenchOptions& bopts, const std::string& reffa, const std::string& peaksbed) {
+  const int line_width = 60;
+  const char bases[] = {'A', 'C', 'G', 'T'};
+  std::mt19937 rng(bopts.seed);
+  std::ofstream fasta(reffa.c_str());
+  std::ofstream fai((reffa+".fai").c_str());
+  std::ofstream peaks(peaksbed.c_str());
+  std::int64_t offset = 0;
+  for (int chrom_index=0; chrom_index<bopts.num_chroms; chrom_index++) {
+    std::string chrom = "chr" + std::to_string(chrom_index+1);
+    std::string header = ">" + chrom + "\n";
+    fasta << header;
+    offset += header.size();
+    fai << chrom << "\t" << bopts.chrom_length << "\t" << offset << "\t"
+	<< line_width << "\t" << line_width+1 << "\n";
+    std::string line;
+    for (int pos=0; pos<bopts.chrom_length; pos++) {
+      line += (pos < 10000) ? 'N' : bases[rng()%4];
+      if (line.size() == line_width || pos == bopts.chrom_length-1) {
+	fasta << line << "\n";
+	offset += line.size()+1;
+	line.clear();
+      }
+    }
+    for (int start=bopts.peak_spacing; start+1000<bopts.chrom_length; start+=bopts.peak_spacing) {
+      peaks << chrom << "\t" << start << "\t" << start+300+rng()%700 << "\t" << 1+rng()%100 << "\n";
+    }
+  }
+  if (!fasta || !fai || !peaks) {
+    PrintMessageDieOnError("Failed to write benchmark inputs to " + bopts.workdir, M_ERROR);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  BenchOptions bopts;
+  for (int i = 1; i < argc; i++) {
+    int parameterLength = (int)strlen(argv[i]);
+    if ((PARAMETER_CHECK("-h", 2, parameterLength)) ||
+	(PARAMETER_CHECK("--help", 6, parameterLength))) {
+      bench_help();
+      return 0;
+    } else if (PARAMETER_CHECK("--chroms", 8, parameterLength) && (i+1) < argc) {
+      bopts.num_chroms = atoi(argv[++i]);
+    } else if (PARAMETER_CHECK("--chrom-length", 14, parameterLength) && (i+1) < argc) {
+      bopts.chrom_length = atoi(argv[++i]);
+    } else if (PARAMETER_CHECK("--peak-spacing", 14, parameterLength) && (i+1) < argc) {
+      bopts.peak_spacing = atoi(argv[++i]);
+    } else if (PARAMETER_CHECK("--min-time", 10, parameterLength) && (i+1) < argc) {
+      bopts.min_seconds = atof(argv[++i]);
+    } else if (PARAMETER_CHECK("--seed", 6, parameterLength) && (i+1) < argc) {
+      bopts.seed = atoi(argv[++i]);
+    } else if (PARAMETER_CHECK("--workdir", 9, parameterLength) && (i+1) < argc) {
+      bopts.workdir = argv[++i];
+    } else {
+      cerr << endl << "*****ERROR: Unrecognized parameter: " << argv[i] << " *****" << endl << endl;
+      bench_help();
+      return 1;
+    }
+  }
+  if (bopts.num_chroms < 1 || bopts.chrom_length < 20000 || bopts.peak_spacing < 1000) {
+    cerr << "****** ERROR: Need --chroms >= 1, --chrom-length >= 20000 and --peak-spacing >= 1000 ******" << endl;
+    return 1;
+  }
+
+  /*** Synthetic inputs ***/
+  bool own_workdir = bopts.workdir.empty();
+  if (own_workdir) {
+    char dirname[] = "/tmp/chips-bench.XXXXXX";
+    if (mkdtemp(dirname) == NULL) {
+      PrintMessageDieOnError("Failed to create a temporary directory", M_ERROR);
+    }
+    bopts.workdir = dirname;
+  }
+  Options options;
+  options.reffa = bopts.workdir + "/bench.fa";
+  options.peaksbed = bopts.workdir + "/bench.bed";
+  options.peakfiletype = "bed";
+  options.countindex = 4;
+  options.sequencer_type = "HiSeq";
+  options.paired = true;
+  make_inputs(bopts, options.reffa, options.peaksbed);
+
+  PeakIntervals pintervals(options, options.peaksbed, options.peakfiletype, options.chipbam, options.countindex);
+  BinTable bins(options);
+  FragmentLengths frag_lengths(options);
+
+  // Fragments tiling the genome, as pulldown makes them before filtering
+  SimRng rng(bopts.seed);
+  std::vector<Fragment> tiling;
+  for (int chrom_index=0; chrom_index<bopts.num_chroms; chrom_index++) {
+    std::string chrom = "chr" + std::to_string(chrom_index+1);
+    for (std::int32_t pos=0; pos<bopts.chrom_length-2000; ) {
+      std::size_t length = std::max(1, frag_lengths.Sample(rng));
+      tiling.push_back(Fragment(chrom, pos, length));
+      pos += length;
+    }
+  }
+  // Reference sequence of some of them, to feed read simulation
+  RefGenome ref_genome(options.reffa);
+  std::vector<std::string> frag_seqs(1000);
+  for (size_t i=0; i<frag_seqs.size(); i++) {
+    const Fragment& frag = tiling[rng()%tiling.size()];
+    ref_genome.GetSequence(frag.chrom, frag.start, frag.start+frag.length, &frag_seqs[i]);
+  }
+
+  /*** Kernels ***/
+  std::vector<BenchResult> results;
+  size_t bin_index = 0;
+  std::vector<Fragment> pulldown_fragments;
+  std::int64_t fragments_pulled_down = 0;
+  results.push_back(run_bench("Pulldown::Perform", "base", bopts.min_seconds, [&]() {
+	size_t index = bin_index++ % bins.size();
+	const GenomeBin& bin = bins[index];
+	Pulldown pulldown(options, bins, index, frag_lengths);
+	pulldown_fragments.clear();
+	pulldown.Perform(&pulldown_fragments, &pintervals, rng);
+	fragments_pulled_down += pulldown_fragments.size();
+	return (std::int64_t) (bin.end - bin.start);
+      }));
+
+  double uniform_sum = 0;
+  std::int64_t uniforms_drawn = 0;
+  results.push_back(run_bench("SimRng::Uniform", "number", bopts.min_seconds, [&]() {
+	const std::int64_t batch = 10000;
+	for (std::int64_t i=0; i<batch; i++) {
+	  uniform_sum += rng.Uniform();
+	}
+	uniforms_drawn += batch;
+	return batch;
+      }));
+
+  std::int64_t length_sum = 0;
+  std::int64_t lengths_drawn = 0;
+  results.push_back(run_bench("FragmentLengths::Sample", "number", bopts.min_seconds, [&]() {
+	const std::int64_t batch = 10000;
+	for (std::int64_t i=0; i<batch; i++) {
+	  length_sum += frag_lengths.Sample(rng);
+	}
+	lengths_drawn += batch;
+	return batch;
+      }));
+
+  size_t frag_index = 0;
+  results.push_back(run_bench("PeakIntervals::GetOverlap", "query", bopts.min_seconds, [&]() {
+	// Queries go along the chromosomes, like in pulldown
+	const std::int64_t batch = 10000;
+	for (std::int64_t i=0; i<batch; i++, frag_index++) {
+	  if (frag_index >= tiling.size()) frag_index = 0;
+	  pintervals.GetOverlap(tiling[frag_index]);
+	}
+	return batch;
+      }));
+
+  results.push_back(run_bench("RefGenome::GetSequence", "base", bopts.min_seconds, [&]() {
+	const Fragment& frag = tiling[frag_index++ % tiling.size()];
+	std::string seq;
+	ref_genome.GetSequence(frag.chrom, frag.start, frag.start+frag.length, &seq);
+	return (std::int64_t) seq.size();
+      }));
+
+  PackedGenome packed_genome(options.reffa);
+  std::string packed_seq;
+  results.push_back(run_bench("PackedGenome::GetSequence", "base", bopts.min_seconds, [&]() {
+	const Fragment& frag = tiling[frag_index++ % tiling.size()];
+	packed_genome.GetSequence(frag.chrom, frag.start, frag.start+frag.length, &packed_seq);
+	return (std::int64_t) packed_seq.size();
+      }));
+
+  Sequencer sequencer(options);
+  size_t seq_index = 0;
+  std::string read;
+  results.push_back(run_bench("Sequencer::Fragment2Read", "read", bopts.min_seconds, [&]() {
+	sequencer.Fragment2Read(frag_seqs[seq_index++ % frag_seqs.size()], read, rng);
+	return (std::int64_t) 1;
+      }));
+
+  results.push_back(run_bench("Sequencer::ReverseComplement", "base", bopts.min_seconds, [&]() {
+	const std::string& seq = frag_seqs[seq_index++ % frag_seqs.size()];
+	return (std::int64_t) sequencer.ReverseComplement(seq).size();
+      }));
+
+  SequencedReads reads;
+  std::vector<Fragment> library(tiling.begin(), tiling.begin()+std::min(tiling.size(), (size_t) 10000));
+  sequencer.Sequence(library, 10000, false, &reads, rng);
+  std::string records;
+  results.push_back(run_bench("Sequencer::FormatFastq", "read", bopts.min_seconds, [&]() {
+	records.clear();
+	sequencer.FormatFastq(reads, 1, &records);
+	sequencer.FormatFastq(reads, 2, &records);
+	return (std::int64_t) reads.reads_1.size();
+      }));
+
+  /*** Report ***/
+  std::cout << "kernel\tunit\tns_per_unit\tallocs_per_unit\tunits" << std::endl;
+  for (size_t i=0; i<results.size(); i++) {
+    std::cout << results[i].name << "\t" << results[i].unit << "\t"
+	      << std::fixed << std::setprecision(2) << results[i].ns_per_unit << "\t"
+	      << std::setprecision(4) << results[i].allocs_per_unit << "\t"
+	      << results[i].units << std::endl;
+  }
+  std::cerr << "Mean uniform " << uniform_sum/uniforms_drawn << std::endl;
+  std::cerr << "Mean fragment length " << (double) length_sum/lengths_drawn << std::endl;
+  std::cerr << "Pulled down " << fragments_pulled_down << " fragments over "
+	    << bins.size() << " bins of " << options.binsize << "bp" << std::endl;
+
+  if (own_workdir) {
+    std::remove(options.reffa.c_str());
+    std::remove((options.reffa+".fai").c_str());
+    std::remove(options.peaksbed.c_str());
+    rmdir(bopts.workdir.c_str());
+  }
+  return 0;
+}
+
+void bench_help(void) {
+  BenchOptions bopts;
+  cerr << "\nTool:    chips-bench" << endl;
+  cerr << "Version: " << chips_VERSION_MAJOR << "." << chips_VERSION_MINOR << "\n";
+  cerr << "Summary: Time the simulation kernels on a synthetic genome and peaks." << endl << endl;
+  cerr << "Usage:   chips-bench [OPTIONS]" << endl << endl;
+  cerr << "Prints one line per kernel: time and heap allocations per unit of work.\n\n";
+  cerr << "[Optional arguments]: " << "\n";
+  cerr << "     --chroms <int>              : Number of chromosomes. Default: " << bopts.num_chroms << "\n";
+  cerr << "     --chrom-length <int>        : Length of each chromosome. Default: " << bopts.chrom_length << "\n";
+  cerr << "     --peak-spacing <int>        : Distance between peak starts. Default: " << bopts.peak_spacing << "\n";
+  cerr << "     --min-time <float>          : Seconds to run each kernel for. Default: " << bopts.min_seconds << "\n";
+  cerr << "     --seed <unsigned>           : Random seed of the inputs. Default: " << bopts.seed << "\n";
+  cerr << "     --workdir <dir>             : Where to write the inputs (kept). Default: a temporary directory\n";
+  cerr << "\n";
+}
@@ -9,6 +9,7 @@ using namespace std;
 int chips_help(void);
 int simulate_reads_main(int argc, char* argv[1]);
 int learn_main(int argc, char* argv[1]);
+int index_ref_main(int argc, char* argv[1]);
 
 int main(int argc, char* argv[]) {
   // make sure the user at least entered a sub_command
@@ -20,6 +21,8 @@ int main(int argc, char* argv[]) {
     return simulate_reads_main(argc-1, argv+1);
   } else if (sub_cmd == "learn") {
     return learn_main(argc-1, argv+1);
+  } else if (sub_cmd == "index-ref") {
+    return index_ref_main(argc-1, argv+1);
   } else if (sub_cmd == "-h" || sub_cmd == "--help" ||
 	   sub_cmd == "-help") {
     return chips_help();
@@ -38,6 +41,7 @@ int chips_help(void) {
   cout << "The chips sub-commands include:"<<endl;
   cout << "     simreads      " << "Simulate ChIP-seq reads given a set of intervals.\n";
   cout << "     learn         " << "Learn model from real ChIP data.\n";
+  cout << "     index-ref     " << "Write a reference image to share between simreads runs.\n";
   cout  << endl;
   cout  << "[ General help ]:" << endl;
   cout  << "    --help        "  << "Print this help menu.\n";
@@ -0,0 +1,147 @@
+/*
+  Check that a reference reads the same whether plain or bgzipped, for
+  finding runs of N and for packing it
+ */
+#include "htslib/bgzf.h"
+#include "htslib/faidx.h"
+#include "lib/n_run_index.h"
+#include "lib/packed_genome.h"
+#include "lib/ref_genome.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+int failures = 0;
+
+void Check(const bool& ok, const std::string& what) {
+  if (!ok) {
+    std::cerr << what << std::endl;
+    failures++;
+  }
+}
+
+/* Random bases in both cases, with runs of N of many lengths */
+std::string RandomSequence(const int64_t& length, std::mt19937& gen) {
+  const char bases[] = "ACGTacgt";
+  std::string seq;
+  while ((int64_t) seq.size() < length) {
+    if (gen() % 50 == 0) {
+      seq.append(gen() % 100, (gen() % 2) ? 'N' : 'n');
+    } else {
+      seq.append(1 + gen() % 2000, bases[gen() % 8]);
+    }
+  }
+  seq.resize(length);
+  return seq;
+}
+
+std::string ToFasta(const std::vector<std::string>& names, const std::vector<std::string>& seqs) {
+  std::string fasta;
+  for (size_t i=0; i<seqs.size(); i++) {
+    fasta += ">" + names[i] + " description\n";
+    for (size_t pos=0; pos<seqs[i].size(); pos+=60) {
+      fasta += seqs[i].substr(pos, 60) + "\n";
+    }
+  }
+  return fasta;
+}
+
+std::vector<NRunIndex::Run> ExpectedRuns(const std::string& seq) {
+  const int32_t min_run_length = NRunIndex::MIN_RUN_LENGTH;
+  std::vector<NRunIndex::Run> runs;
+  for (int32_t pos=0; pos<(int32_t) seq.size(); ) {
+    int32_t run_end = pos;
+    while (run_end < (int32_t) seq.size() && toupper(seq[run_end]) == 'N') run_end++;
+    if (run_end-pos >= min_run_length) {
+      NRunIndex::Run run = {pos, run_end};
+      runs.push_back(run);
+    }
+    pos = std::max(pos+1, run_end);
+  }
+  return runs;
+}
+
+void CheckReference(const std::string& reffa, const std::vector<std::string>& names,
+		    const std::vector<std::string>& seqs) {
+  FastaReader reader(reffa);
+  Check(reader.GetEntries().size() == seqs.size(), reffa + ": wrong number of sequences");
+  for (size_t i=0; i<reader.GetEntries().size() && i<seqs.size(); i++) {
+    std::string seq;
+    reader.ReadBases(reader.GetEntries()[i], [&](const char* bases, size_t count) {
+	seq.append(bases, count);
+      });
+    Check(seq == seqs[i], reffa + ": wrong bases for " + names[i]);
+  }
+
+  NRunIndex nrun_index(reffa);
+  for (size_t i=0; i<seqs.size(); i++) {
+    std::vector<NRunIndex::Run> expected = ExpectedRuns(seqs[i]);
+    const std::vector<NRunIndex::Run>* runs = nrun_index.GetRuns(names[i]);
+    bool same = (runs == NULL) ? expected.empty() : (runs->size() == expected.size());
+    for (size_t j=0; same && j<expected.size(); j++) {
+      same = ((*runs)[j].start == expected[j].start && (*runs)[j].end == expected[j].end);
+    }
+    Check(same, reffa + ": wrong runs of N for " + names[i]);
+  }
+
+  // Also what index-ref packs
+  PackedGenome packed_genome(reffa);
+  for (size_t i=0; i<seqs.size(); i++) {
+    std::string seq, expected(seqs[i]);
+    std::transform(expected.begin(), expected.end(), expected.begin(), ::tolower);
+    packed_genome.GetSequence(names[i], 0, (int32_t) seqs[i].size()-1, &seq);
+    Check(seq == expected, reffa + ": wrong packed bases for " + names[i]);
+  }
+}
+}
+
+int main() {
+  char dirname[] = "/tmp/chips-test-XXXXXX";
+  if (mkdtemp(dirname) == NULL) {
+    std::cerr << "Failed to make a temporary directory" << std::endl;
+    return 1;
+  }
+  std::mt19937 gen(3);
+  std::vector<std::string> names, seqs;
+  names.push_back("chr1");
+  seqs.push_back(std::string(30, 'N') + RandomSequence(2500000, gen) + std::string(25, 'n'));
+  names.push_back("chr2");
+  seqs.push_back(RandomSequence(1000, gen));
+  names.push_back("chr3");
+  seqs.push_back(RandomSequence((1 << 20) + 1, gen));
+  std::string fasta = ToFasta(names, seqs);
+
+  std::string plain = std::string(dirname) + "/ref.fa";
+  std::ofstream output(plain.c_str());
+  output << fasta;
+  output.close();
+  std::string bgzipped = std::string(dirname) + "/ref.fa.gz";
+  BGZF* bgzf = bgzf_open(bgzipped.c_str(), "w");
+  if (bgzf == NULL || bgzf_write(bgzf, fasta.data(), fasta.size()) < 0 || bgzf_close(bgzf) < 0) {
+    std::cerr << "Failed to write " << bgzipped << std::endl;
+    return 1;
+  }
+  if (fai_build(plain.c_str()) != 0 || fai_build(bgzipped.c_str()) != 0) {
+    std::cerr << "Failed to index the test references" << std::endl;
+    return 1;
+  }
+
+  CheckReference(plain, names, seqs);
+  CheckReference(bgzipped, names, seqs);
+
+  const char* files[] = {"/ref.fa", "/ref.fa.fai", "/ref.fa.gz", "/ref.fa.gz.fai", "/ref.fa.gz.gzi"};
+  for (size_t i=0; i<sizeof(files)/sizeof(files[0]); i++) {
+    unlink((std::string(dirname) + files[i]).c_str());
+  }
+  rmdir(dirname);
+  return (failures > 0) ? 1 : 0;
+}
@@ -0,0 +1,118 @@
+/*
+  Check the peak interval tree against a linear scan over the peaks,
+  for trees of many sizes (complete and not) with peaks of mixed lengths
+ */
+#include "lib/peak_intervals.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+
+namespace {
+int failures = 0;
+
+void Fail(const std::string& what, const int& npeaks, const std::int32_t& start, const std::int32_t& length) {
+  if (failures++ < 10) {
+    std::cerr << what << " wrong with " << npeaks << " peaks, fragment "
+	      << start << "+" << length << std::endl;
+  }
+}
+
+/* Write npeaks peaks on chrA, mostly short with some long ones spanning many others */
+void WritePeaks(const std::string& filename, const int& npeaks, std::mt19937& gen) {
+  std::ofstream bed(filename.c_str());
+  std::int32_t span = 200*npeaks + 1000;
+  for (int i=0; i<npeaks; i++) {
+    std::int32_t start = gen() % span;
+    std::int32_t length;
+    switch (gen() % 4) {
+    case 0: length = 1 + gen() % 20; break;
+    case 1: length = 50 + gen() % 500; break;
+    case 2: length = 500 + gen() % 5000; break;
+    default: length = 1 + gen() % (span/2); break;
+    }
+    bed << "chrA\t" << start << "\t" << start+length << "\tpeak" << i << "\t" << 1 + gen() % 100 << "\n";
+  }
+}
+
+void CheckTree(const std::string& bedfile, const int& npeaks, std::mt19937& gen) {
+  Options options;
+  PeakIntervals pintervals(options, bedfile, "bed", "", 5);
+  const std::vector<Fragment>& peaks = pintervals.GetPeaks().at("chrA");
+  int contig_id = pintervals.GetContigId("chrA");
+  std::int32_t span = 200*npeaks + 1000;
+  // Random fragments, then one ending each peak, which a subtree max
+  // end that is too small would miss
+  for (size_t q=0; q<5000+peaks.size(); q++) {
+    std::int32_t start, length;
+    if (q < 5000) {
+      start = gen() % (span + 6000) - 1000;
+      length = 1 + gen() % ((q % 2) ? 50 : 3000);
+    } else {
+      const Fragment& peak = peaks[q-5000];
+      start = peak.start + peak.length - 1;
+      length = 1 + gen() % 50;
+    }
+    float prob_unbound = 1, expected_sum = 0;
+    bool found = false;
+    for (size_t i=0; i<peaks.size(); i++) {
+      std::int32_t peak_end = peaks[i].start + peaks[i].length;
+      if (peaks[i].start < start+length && start < peak_end) {
+	float overlap = (float) (std::min(peak_end, start+length) - std::max(peaks[i].start, start)) / length;
+	prob_unbound *= 1-overlap*peaks[i].score;
+	expected_sum += overlap*peaks[i].score;
+	found = true;
+      }
+    }
+    float expected = found ? 1-prob_unbound : 0;
+    float score_sum;
+    float prob = pintervals.GetOverlap(contig_id, start, length, &score_sum);
+    if (std::fabs(prob-expected) > 1e-5 || std::fabs(score_sum-expected_sum) > 1e-4*std::max(1.0f, expected_sum)) {
+      Fail("GetOverlap", npeaks, start, length);
+    }
+
+    // Nothing overlaps the peak-free stretch, and it ends at a peak or never
+    std::int32_t free_end = pintervals.GetPeakFreeEnd(contig_id, start);
+    std::int32_t expected_end = std::numeric_limits<std::int32_t>::max();
+    for (size_t i=0; i<peaks.size(); i++) {
+      std::int32_t peak_end = peaks[i].start + peaks[i].length;
+      if (peak_end > start) expected_end = std::min(expected_end, std::max(start, peaks[i].start));
+    }
+    if (free_end != expected_end) {
+      Fail("GetPeakFreeEnd", npeaks, start, 0);
+    }
+  }
+}
+}
+
+int main() {
+  char dirname[] = "/tmp/chips-test-XXXXXX";
+  if (mkdtemp(dirname) == NULL) {
+    std::cerr << "Failed to make a temporary directory" << std::endl;
+    return 1;
+  }
+  std::string bedfile = std::string(dirname) + "/peaks.bed";
+  std::mt19937 gen(11);
+  const int sizes[] = {1, 2, 3, 5, 8, 15, 16, 17, 31, 33, 63, 64, 65, 66, 100, 127, 128, 129,
+		       200, 255, 300, 511, 513, 777, 855, 1000, 1023, 1025, 1500, 2047, 2222, 3000};
+  for (size_t s=0; s<sizeof(sizes)/sizeof(sizes[0]); s++) {
+    for (int rep=0; rep<3; rep++) {
+      WritePeaks(bedfile, sizes[s], gen);
+      CheckTree(bedfile, sizes[s], gen);
+    }
+  }
+  unlink(bedfile.c_str());
+  rmdir(dirname);
+  if (failures > 0) {
+    std::cerr << failures << " mismatches" << std::endl;
+    return 1;
+  }
+  return 0;
+}
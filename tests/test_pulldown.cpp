@@ -0,0 +1,101 @@
+/*
+  Check that pulldown keeps the same fragments, in distribution, whether
+  it scores every fragment (--exact-pulldown) or draws how many
+  background fragments to throw away between peaks
+ */
+#include "lib/bingenerator.h"
+#include "lib/fragment_lengths.h"
+#include "lib/peak_intervals.h"
+#include "lib/pulldown.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+const std::int32_t RegionLength = 20000;
+const std::int32_t WindowSize = 250;
+const int NumWindows = RegionLength/WindowSize;
+const int Replicates = 20000;
+
+struct Counts {
+  std::vector<double> starts;  // kept fragments starting in each window
+  std::vector<double> lengths; // and their total length
+  Counts() : starts(NumWindows, 0), lengths(NumWindows, 0) {}
+};
+
+Counts RunPulldown(Options options, PeakIntervals* pintervals, const bool& exact) {
+  options.exact_pulldown = exact;
+  BinTable bins(options);
+  FragmentLengths frag_lengths(options);
+  Counts counts;
+  std::vector<Fragment> fragments;
+  for (int rep=0; rep<Replicates; rep++) {
+    SimRng rng(exact ? 1 : 2, rep);
+    for (size_t bin_index=0; bin_index<bins.size(); bin_index++) {
+      Pulldown pulldown(options, bins, bin_index, frag_lengths);
+      fragments.clear();
+      pulldown.Perform(&fragments, pintervals, rng);
+      for (size_t i=0; i<fragments.size(); i++) {
+	int window = (fragments[i].start-1)/WindowSize;
+	if (window < 0 || window >= NumWindows) continue;
+	counts.starts[window]++;
+	counts.lengths[window] += fragments[i].length;
+      }
+    }
+  }
+  return counts;
+}
+}
+
+int main() {
+  char dirname[] = "/tmp/chips-test-XXXXXX";
+  if (mkdtemp(dirname) == NULL) {
+    std::cerr << "Failed to make a temporary directory" << std::endl;
+    return 1;
+  }
+  // Peaks of several widths and scores, some closer together than a fragment
+  std::string bedfile = std::string(dirname) + "/peaks.bed";
+  std::ofstream bed(bedfile.c_str());
+  bed << "chrA\t3000\t3400\tp1\t0.9\n"
+      << "chrA\t3600\t3650\tp2\t0.5\n"
+      << "chrA\t8000\t8010\tp3\t1\n"
+      << "chrA\t12000\t14000\tp4\t0.3\n"
+      << "chrA\t17000\t17300\tp5\t0.7\n";
+  bed.close();
+
+  Options options;
+  options.region = "chrA:1-" + std::to_string(RegionLength+1);
+  options.binsize = 5000;
+  options.noscale = true;
+  options.gamma_k = 4;
+  options.gamma_theta = 50;
+  PeakIntervals pintervals(options, bedfile, "bed", "", 5);
+  Counts exact = RunPulldown(options, &pintervals, true);
+  Counts fast = RunPulldown(options, &pintervals, false);
+  unlink(bedfile.c_str());
+  rmdir(dirname);
+
+  // Both are sums of many independent replicates, so compare each window
+  // as a difference of Poisson counts (or of sums of lengths)
+  int failures = 0;
+  double mean_length = options.gamma_k*options.gamma_theta;
+  for (int window=0; window<NumWindows; window++) {
+    double z_starts = (exact.starts[window]-fast.starts[window]) /
+      std::sqrt(exact.starts[window]+fast.starts[window]+1);
+    double z_lengths = (exact.lengths[window]-fast.lengths[window]) /
+      std::sqrt((exact.starts[window]+fast.starts[window]+1)*2*mean_length*mean_length);
+    if (std::fabs(z_starts) > 5 || std::fabs(z_lengths) > 5) {
+      std::cerr << "Window at " << window*WindowSize << ": exact kept " << exact.starts[window]
+		<< " fragments, " << exact.lengths[window] << " bases, fast kept " << fast.starts[window]
+		<< " fragments, " << fast.lengths[window] << " bases" << std::endl;
+      failures++;
+    }
+  }
+  return (failures > 0) ? 1 : 0;
+}
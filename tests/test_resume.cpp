@@ -0,0 +1,218 @@
+/*
+  Check --resume end to end: cut a finished run back to some of its
+  copies plus a partly written one, resume it, and check that the files
+  are cut back to the journal, only the missing copies are simulated,
+  and the output is that of the uninterrupted run. Also check that a
+  journal of other settings, or of a run stopped while merging, is
+  refused without touching the files
+ */
+#include "lib/json.hpp"
+#include "lib/packed_genome.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+int simulate_reads_main(int argc, char* argv[]);
+
+namespace {
+int failures = 0;
+std::string workdir;
+
+void Check(const bool& ok, const std::string& what) {
+  if (!ok) {
+    std::cerr << what << std::endl;
+    failures++;
+  }
+}
+
+std::string ReadFile(const std::string& filename) {
+  std::ifstream input(filename.c_str(), std::ios::binary);
+  std::stringstream ss;
+  ss << input.rdbuf();
+  return ss.str();
+}
+
+void WriteFile(const std::string& filename, const std::string& content) {
+  std::ofstream output(filename.c_str(), std::ios::binary | std::ios::trunc);
+  output << content;
+}
+
+/* Run simreads in a child process, since errors exit. Returns its exit status */
+int RunSimreads(const std::vector<std::string>& args) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    int log = open((workdir + "/simreads.log").c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    dup2(log, 2);
+    std::vector<char*> argv;
+    argv.push_back((char*) "simreads");
+    for (size_t i=0; i<args.size(); i++) {
+      argv.push_back((char*) args[i].c_str());
+    }
+    argv.push_back(NULL);
+    _exit(simulate_reads_main((int) argv.size()-1, argv.data()));
+  }
+  int status;
+  if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) {
+    return -1;
+  }
+  return WEXITSTATUS(status);
+}
+
+/* A reference image and peaks to simulate from */
+void MakeInputs(const std::string& image, const std::string& bedfile) {
+  std::mt19937 gen(7);
+  std::string fasta, fai;
+  const int64_t length = 60000;
+  for (int chrom=1; chrom<=2; chrom++) {
+    std::string header = ">chr" + std::to_string(chrom) + "\n";
+    fai += "chr" + std::to_string(chrom) + "\t" + std::to_string(length) + "\t" +
+      std::to_string(fasta.size()+header.size()) + "\t60\t61\n";
+    fasta += header;
+    for (int64_t pos=0; pos<length; pos+=60) {
+      for (int i=0; i<60; i++) fasta += "ACGT"[gen() % 4];
+      fasta += "\n";
+    }
+  }
+  std::string fasta_file = workdir + "/ref.fa";
+  WriteFile(fasta_file, fasta);
+  WriteFile(fasta_file + ".fai", fai);
+  PackedGenome(fasta_file).WriteImage(image);
+  WriteFile(bedfile, "chr1\t10000\t11000\tp1\t50\nchr1\t30000\t30500\tp2\t100\nchr2\t20000\t22000\tp3\t20\n");
+}
+
+/* Reads (4 lines each) in bytes [start, end) of a FASTQ */
+int64_t CountReads(const std::string& fastq, const int64_t& start, const int64_t& end) {
+  int64_t lines = 0;
+  for (int64_t i=start; i<end; i++) {
+    if (fastq[i] == '\n') lines++;
+  }
+  return lines/4;
+}
+}
+
+int main() {
+  char dirname[] = "/tmp/chips-test-XXXXXX";
+  if (mkdtemp(dirname) == NULL) {
+    std::cerr << "Failed to make a temporary directory" << std::endl;
+    return 1;
+  }
+  workdir = dirname;
+  std::string image = workdir + "/ref.chipsref";
+  std::string bedfile = workdir + "/peaks.bed";
+  MakeInputs(image, bedfile);
+
+  // Three writers with two copies each
+  std::string outprefix = workdir + "/reads";
+  std::vector<std::string> args = {"-f", image, "--packed-ref", "-p", bedfile, "-t", "bed", "-c", "5",
+				   "--numcopies", "6", "--numreads", "3000", "--write-threads", "3",
+				   "--keep-shards", "-o", outprefix, "--seed", "5"};
+  const int num_writers = 3;
+  std::vector<std::string> writer_files;
+  for (int writer_index=0; writer_index<num_writers; writer_index++) {
+    writer_files.push_back(outprefix + "_" + std::to_string(writer_index) + ".fastq");
+  }
+
+  // The full run. Its journal is removed at the end, so keep a hard link
+  std::string journal_file = outprefix + ".journal";
+  std::string saved_journal = workdir + "/saved.journal";
+  WriteFile(journal_file, "");
+  if (link(journal_file.c_str(), saved_journal.c_str()) != 0 || RunSimreads(args) != 0) {
+    std::cerr << "Failed to simulate the full run" << std::endl;
+    return 1;
+  }
+  std::vector<std::string> full_output;
+  for (int writer_index=0; writer_index<num_writers; writer_index++) {
+    full_output.push_back(ReadFile(writer_files[writer_index]));
+  }
+  std::string header;
+  std::map<int, std::string> copy_lines;
+  std::map<int, int64_t> copy_end; // size of its writer's file after the copy
+  std::istringstream journal(ReadFile(saved_journal));
+  std::string line;
+  while (std::getline(journal, line)) {
+    if (line.compare(0, 5, "#seed") == 0 || line.compare(0, 9, "#settings") == 0) {
+      header += line + "\n";
+    } else if (!line.empty() && line[0] != '#') {
+      std::istringstream fields(line);
+      int copy_index, writer_index;
+      int64_t size;
+      fields >> copy_index >> writer_index >> size;
+      copy_lines[copy_index] = line + "\n";
+      copy_end[copy_index] = size;
+    }
+  }
+  if (copy_lines.size() != 6) {
+    std::cerr << "Expected 6 copies in the journal, got " << copy_lines.size() << std::endl;
+    return 1;
+  }
+
+  /*
+    Stop writer 0 after both its copies, writer 1 part way through its
+    second copy (which isn't recorded), and writer 2 after its first
+    copy, with a journal line for the second one that runs ahead of the
+    file, as if the machine went down before the data reached the disk.
+    The journal ends with a line cut off while it was written
+   */
+  std::vector<std::string> interrupted(num_writers);
+  interrupted[0] = full_output[0];
+  interrupted[1] = full_output[1].substr(0, copy_end[2] + (copy_end[3]-copy_end[2])/2);
+  interrupted[2] = full_output[2].substr(0, copy_end[4]);
+  std::string interrupted_journal = header + copy_lines[0] + copy_lines[1] + copy_lines[2] + copy_lines[4] +
+    "5\t2\t" + std::to_string(copy_end[5]+1000) + "\n" + "3\t1";
+  auto interrupt = [&](const std::string& journal_content) {
+    for (int writer_index=0; writer_index<num_writers; writer_index++) {
+      WriteFile(writer_files[writer_index], interrupted[writer_index]);
+    }
+    WriteFile(journal_file, journal_content);
+  };
+  std::vector<std::string> resume_args(args);
+  resume_args.push_back("--resume");
+
+  // Journals that can't be resumed are refused before anything is cut
+  std::vector<std::string> other_args(resume_args);
+  other_args[12] = "2000"; // --numreads
+  interrupt(interrupted_journal);
+  Check(RunSimreads(other_args) == 1, "Resumed a run with other settings");
+  interrupt(header + copy_lines[0] + copy_lines[1] + copy_lines[2] + copy_lines[4] + "#merge\n");
+  Check(RunSimreads(resume_args) == 1, "Resumed a run stopped while merging");
+  for (int writer_index=0; writer_index<num_writers; writer_index++) {
+    Check(ReadFile(writer_files[writer_index]) == interrupted[writer_index],
+	  "Refused resume changed " + writer_files[writer_index]);
+  }
+
+  // Only copies 3 and 5 are left to simulate
+  interrupt(interrupted_journal);
+  std::string stats_file = workdir + "/stats.json";
+  resume_args.push_back("--stats-json");
+  resume_args.push_back(stats_file);
+  Check(RunSimreads(resume_args) == 0, "Resumed run failed");
+  for (int writer_index=0; writer_index<num_writers; writer_index++) {
+    Check(ReadFile(writer_files[writer_index]) == full_output[writer_index],
+	  "Resumed run differs from the full run in " + writer_files[writer_index]);
+  }
+  int64_t missing_reads = CountReads(full_output[1], copy_end[2], copy_end[3]) +
+    CountReads(full_output[2], copy_end[4], copy_end[5]);
+  nlohmann::json stats = nlohmann::json::parse(ReadFile(stats_file));
+  Check(stats["counters"]["reads_written"].get<int64_t>() == missing_reads,
+	"Resumed run wrote other reads than those of the missing copies");
+  Check(access(journal_file.c_str(), F_OK) == -1, "Journal left after the resumed run finished");
+
+  const char* files[] = {"/ref.fa", "/ref.fa.fai", "/ref.chipsref", "/peaks.bed", "/saved.journal",
+			 "/reads.journal", "/reads.journal.tmp", "/reads.manifest", "/reads_0.fastq",
+			 "/reads_1.fastq", "/reads_2.fastq", "/stats.json", "/simreads.log"};
+  for (size_t i=0; i<sizeof(files)/sizeof(files[0]); i++) {
+    unlink((workdir + files[i]).c_str());
+  }
+  rmdir(dirname);
+  return (failures > 0) ? 1 : 0;
+}
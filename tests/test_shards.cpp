@@ -0,0 +1,130 @@
+/*
+  Check that shards split the genome copies without gaps or overlaps,
+  and that merging appends shard outputs on every path merge_files takes
+ */
+#include "lib/shard_files.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+int failures = 0;
+
+void Check(const bool& ok, const std::string& what) {
+  if (!ok) {
+    std::cerr << what << std::endl;
+    failures++;
+  }
+}
+
+/* Every copy must fall in exactly one shard, and shards must come in order */
+void CheckCopyRanges(const int numcopies, const int num_shards) {
+  std::string what = std::to_string(numcopies) + " copies in " + std::to_string(num_shards) + " shards";
+  std::vector<int> shard_of_copy(numcopies, -1);
+  int previous_end = 0;
+  for (int shard_index=0; shard_index<num_shards; shard_index++) {
+    int copy_begin, copy_end;
+    shard_copy_range(numcopies, shard_index, num_shards, &copy_begin, &copy_end);
+    Check(copy_begin == previous_end && copy_begin <= copy_end,
+	  what + ": shard " + std::to_string(shard_index) + " doesn't start where the last one ended");
+    Check(copy_end - copy_begin <= numcopies/num_shards + 1,
+	  what + ": shard " + std::to_string(shard_index) + " is too large");
+    for (int copy_index=copy_begin; copy_index<copy_end && copy_index<numcopies; copy_index++) {
+      Check(shard_of_copy[copy_index] == -1, what + ": copy " + std::to_string(copy_index) + " is in two shards");
+      shard_of_copy[copy_index] = shard_index;
+    }
+    previous_end = copy_end;
+  }
+  Check(previous_end == numcopies, what + ": copies past the last shard are missing");
+}
+
+std::string ReadFile(const std::string& filename) {
+  std::ifstream input(filename.c_str(), std::ios::binary);
+  std::stringstream contents;
+  contents << input.rdbuf();
+  return contents.str();
+}
+
+void WriteFile(const std::string& filename, const std::string& contents) {
+  std::ofstream output(filename.c_str(), std::ios::binary);
+  output << contents;
+}
+
+std::string RandomBytes(const size_t length, std::mt19937& gen) {
+  std::string bytes(length, '\0');
+  for (size_t i=0; i<length; i++) {
+    bytes[i] = (char) (gen() % 256);
+  }
+  return bytes;
+}
+
+/* Merge shards into a destination that starts as dest_start (missing if NULL) */
+void CheckMerge(const std::string& dir, const std::vector<std::string>& shards,
+		const std::string* dest_start, const bool& kernel_copy, const std::string& what) {
+  std::string dest = dir + "/merged";
+  std::string expected;
+  unlink(dest.c_str());
+  if (dest_start != NULL) {
+    WriteFile(dest, *dest_start);
+    expected = *dest_start;
+  }
+  for (size_t i=0; i<shards.size(); i++) {
+    std::string shard = dir + "/shard" + std::to_string(i);
+    WriteFile(shard, shards[i]);
+    expected += shards[i];
+  }
+  for (size_t i=0; i<shards.size(); i++) {
+    std::string shard = dir + "/shard" + std::to_string(i);
+    merge_files(shard, dest, kernel_copy);
+    Check(access(shard.c_str(), F_OK) == -1, what + ": shard " + std::to_string(i) + " wasn't removed");
+  }
+  // A missing source (a writer that had no copies) leaves the destination alone
+  merge_files(dir + "/missing", dest, kernel_copy);
+  Check(ReadFile(dest) == expected, what + ": merged file differs");
+  unlink(dest.c_str());
+}
+}  // namespace
+
+int main() {
+  for (int num_shards=1; num_shards<=12; num_shards++) {
+    for (int numcopies=0; numcopies<=50; numcopies++) {
+      CheckCopyRanges(numcopies, num_shards);
+    }
+    CheckCopyRanges(1000003, num_shards);
+  }
+
+  char dirname[] = "/tmp/chips-test-XXXXXX";
+  if (mkdtemp(dirname) == NULL) {
+    std::cerr << "Failed to make a temporary directory" << std::endl;
+    return 1;
+  }
+  std::string dir(dirname);
+  std::mt19937 gen(11);
+  // Larger than a merge block, so the copy loops go around more than once
+  std::vector<std::string> shards;
+  shards.push_back(RandomBytes((1 << 22) + 12345, gen));
+  shards.push_back("");
+  shards.push_back(RandomBytes(1000, gen));
+  std::string existing = RandomBytes(777, gen);
+  std::string empty;
+
+  for (int kernel_copy=0; kernel_copy<=1; kernel_copy++) {
+    std::string path = kernel_copy ? "copy_file_range" : "read/write";
+    // Missing destination: the first shard is renamed, the rest appended
+    CheckMerge(dir, shards, NULL, kernel_copy, path + ", missing destination");
+    CheckMerge(dir, shards, &empty, kernel_copy, path + ", empty destination");
+    CheckMerge(dir, shards, &existing, kernel_copy, path + ", existing destination");
+    // Only an empty shard into a missing destination
+    CheckMerge(dir, std::vector<std::string>(1, ""), NULL, kernel_copy, path + ", empty shard only");
+  }
+
+  rmdir(dirname);
+  return (failures > 0) ? 1 : 0;
+}